@@ -0,0 +1,535 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <ostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "format.h"
+
+//
+// Local on-disk archive of completed windows.
+//
+// Layout under `dir`:
+//   seg-<n>.bin  append-only segment files. Each record is a
+//                `RecordHeader` followed by `channels` columns of
+//                `numSamples` floats (channel-major); `kind` tells
+//                windows from idle runs (see idle.h).
+//   index.bin    sparse index of `IndexEntry`s (sensor, measure id,
+//                timestamp). Only every `_indexStride`-th record of a
+//                sensor (and the first one in each segment) is indexed;
+//                queries seek to the closest entry by timestamp and scan
+//                forward. Measure ids restart with every measurement, so
+//                they tell records apart but cannot be seeked on.
+//
+// Reads go through `mmap`, so range queries and re-export never parse
+// text. Whenever the total size exceeds `capBytes`, the oldest sealed
+// segments are dropped and the index is rewritten without them; segments
+// are kept to a quarter of the cap so the active one alone never breaks
+// it. A record torn by a crash is cut off the active segment on `open`.
+//
+struct Archive {
+  static const uint32_t kMagic = 0x57524b44; // "DKRW"
+
+  struct RecordHeader {
+    uint32_t magic;
+    uint16_t sensor;
+    uint8_t channels;
+    uint8_t kind;           // `MEASURE_*` (data.h); 0 in older records
+    int32_t id;
+    int32_t context;
+    uint64_t timestamp;     // s
+    uint32_t numSamples;
+    uint32_t samplingPeriod; // ms
+  };
+
+  struct IndexEntry {
+    uint16_t sensor;
+    uint16_t _pad;
+    int32_t id;
+    uint64_t timestamp;
+    uint32_t segment;
+    uint32_t offset;
+  };
+
+  // A record as seen through a mapping; valid until the callback returns
+  struct RecordView {
+    const RecordHeader *hdr;
+    const float *columns;
+
+    const float *channel(std::size_t c) const
+    {
+      return columns + c * hdr->numSamples;
+    }
+  };
+
+  // Upper bound of a record formatted by `formatCsv`
+  static std::size_t csvBytes(const RecordHeader& hdr)
+  {
+    return 64 + 24 * (std::size_t)hdr.channels * hdr.numSamples;
+  }
+
+  //
+  // Write a record as a CSV row at `p` and return the end: `id,context,
+  // sensor,kind`, then the samples channel after channel (the
+  // `Measure::format` layout plus the record kind), numbers as format.h
+  // writes them. Every CSV export of records goes through here.
+  //
+  static char *formatCsv(char *p, const RecordHeader& hdr,
+                         const float *columns)
+  {
+    p = formatInt(p, hdr.id);
+    *p++ = ',';
+    p = formatInt(p, hdr.context);
+    *p++ = ',';
+    p = formatInt(p, hdr.sensor);
+    *p++ = ',';
+    p = formatInt(p, hdr.kind);
+    std::size_t n = (std::size_t)hdr.channels * hdr.numSamples;
+    for (std::size_t j = 0; j < n; j++) {
+      *p++ = ',';
+      p = formatFloat(p, columns[j]);
+    }
+    *p++ = '\n';
+    return p;
+  }
+
+  Archive() : _capBytes(0), _segmentBytes(0), _indexStride(16), _active(0),
+              _activeFd(-1), _activeSize(0), _totalBytes(0) {}
+
+  ~Archive() { close(); }
+
+  Archive(const Archive&) = delete;
+  Archive& operator=(const Archive&) = delete;
+
+  bool open(const std::string& dir, std::size_t capBytes,
+            std::size_t segmentBytes = 4 * 1024 * 1024)
+  {
+    std::lock_guard<std::mutex> lk(m);
+
+    _dir = dir;
+    if (!_dir.empty() && _dir.back() != '/')
+      _dir += '/';
+    _capBytes = capBytes;
+    _segmentBytes = std::min(segmentBytes,
+                             std::max(capBytes / 4, sizeof(RecordHeader)));
+
+    mkdir(_dir.c_str(), 0700);
+
+    // Discover existing segments
+    _segments.clear();
+    _totalBytes = 0;
+    DIR *d = opendir(_dir.c_str());
+    if (!d)
+      return false;
+    while (struct dirent *e = readdir(d)) {
+      unsigned int n;
+      if (sscanf(e->d_name, "seg-%u.bin", &n) == 1) {
+        std::size_t size = fileSize(segmentPath(n));
+        _segments[n] = size;
+        _totalBytes += size;
+      }
+    }
+    closedir(d);
+
+    _active = _segments.empty() ? 0 : _segments.rbegin()->first;
+    bool truncated = truncateTorn();
+    loadIndex();
+    if (truncated)
+      rewriteIndex();
+    if (!openActive())
+      return false;
+    enforceCap();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    for (auto& kv : _maps)
+      munmap(kv.second.first, kv.second.second);
+    _maps.clear();
+    if (_activeFd >= 0) {
+      ::close(_activeFd);
+      _activeFd = -1;
+    }
+  }
+
+  // Unmap cached segment mappings (they are re-created on demand)
+  void trimCache()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    for (auto& kv : _maps)
+      munmap(kv.second.first, kv.second.second);
+    _maps.clear();
+  }
+
+  //
+  // Header of the record of `measure`: `MeasureBase` or anything exposing
+  // the same fields and `_numChannels()`, `_numSamples()` and `_period()`.
+  //
+  template <typename M>
+  static RecordHeader headerOf(const M& measure)
+  {
+    RecordHeader hdr;
+    hdr.magic = kMagic;
+    hdr.sensor = (uint16_t)measure._type;
+    hdr.channels = (uint8_t)measure._numChannels();
+    hdr.kind = (uint8_t)measure._kind;
+    hdr.id = measure._id;
+    hdr.context = measure._context;
+    hdr.timestamp = measure._timestamp;
+    hdr.numSamples = (uint32_t)measure._numSamples();
+    hdr.samplingPeriod = measure._period();
+    return hdr;
+  }
+
+  //
+  // Append a completed window. `M` is anything `headerOf` accepts that
+  // also has `_channel()`.
+  //
+  template <typename M>
+  bool append(const M& measure)
+  {
+    std::lock_guard<std::mutex> lk(m);
+    if (_activeFd < 0)
+      return false;
+
+    RecordHeader hdr = headerOf(measure);
+
+    std::size_t recordBytes = sizeof(hdr) +
+        sizeof(float) * hdr.channels * hdr.numSamples;
+    if (_activeSize > 0 && _activeSize + recordBytes > _segmentBytes) {
+      if (!rotate())
+        return false;
+    }
+
+    uint32_t offset = (uint32_t)_activeSize;
+    if (!writeAll(&hdr, sizeof(hdr)))
+      return false;
+    for (std::size_t c = 0; c < hdr.channels; c++) {
+      if (!writeAll(measure._channel(c), sizeof(float) * hdr.numSamples))
+        return false;
+    }
+    _activeSize += recordBytes;
+    _segments[_active] = _activeSize;
+    _totalBytes += recordBytes;
+    if (_totalBytes > _capBytes)
+      enforceCap();
+
+    // Sparse index: first record of the sensor in this segment, then
+    // every `_indexStride`-th one
+    uint32_t& count = _sinceIndexed[hdr.sensor];
+    auto seen = _indexedSegment.find(hdr.sensor);
+    bool firstInSegment = seen == _indexedSegment.end() ||
+                          seen->second != _active;
+    if (firstInSegment || ++count >= _indexStride) {
+      IndexEntry e;
+      e.sensor = hdr.sensor;
+      e._pad = 0;
+      e.id = hdr.id;
+      e.timestamp = hdr.timestamp;
+      e.segment = _active;
+      e.offset = offset;
+      _index.push_back(e);
+      appendIndex(e);
+      _indexedSegment[hdr.sensor] = _active;
+      count = 0;
+    }
+    return true;
+  }
+
+  //
+  // Call `fn(const RecordView&)` for every record of `sensor` whose
+  // timestamp lies in [t0, t1]. Returns the number of records visited.
+  // Records of a sensor must have been appended in timestamp order: the
+  // seek and the end of the walk rely on it.
+  //
+  template <typename F>
+  std::size_t scan(int sensor, uint64_t t0, uint64_t t1, F fn)
+  {
+    return scanWhile(sensor, t0, t1, [&fn](const RecordView& r) {
+      fn(r);
+      return true;
+    });
+  }
+
+  // Like `scan`, but stops as soon as `fn` returns false
+  template <typename F>
+  std::size_t scanWhile(int sensor, uint64_t t0, uint64_t t1, F fn)
+  {
+    std::lock_guard<std::mutex> lk(m);
+
+    // Seek: last index entry of `sensor` at or before t0 (or its first
+    // entry if everything is newer)
+    const IndexEntry *start = nullptr;
+    for (const IndexEntry& e : _index) {
+      if (e.sensor != sensor)
+        continue;
+      if (!start || e.timestamp <= t0)
+        start = &e;
+      if (e.timestamp > t0)
+        break;
+    }
+    if (!start)
+      return 0;
+
+    std::size_t visited = 0;
+    uint32_t offset = start->offset;
+    for (auto seg = _segments.find(start->segment); seg != _segments.end();
+         ++seg, offset = 0) {
+      const char *base = mapSegment(seg->first, seg->second);
+      if (!base)
+        continue;
+      std::size_t size = seg->second;
+      while (offset + sizeof(RecordHeader) <= size) {
+        const RecordHeader *hdr = (const RecordHeader *)(base + offset);
+        if (hdr->magic != kMagic)
+          break;
+        std::size_t recordBytes = sizeof(RecordHeader) +
+            sizeof(float) * hdr->channels * hdr->numSamples;
+        if (offset + recordBytes > size)
+          break;
+        if (hdr->sensor == sensor) {
+          if (hdr->timestamp > t1)
+            return visited;
+          if (hdr->timestamp >= t0) {
+            RecordView view = {hdr, (const float *)(hdr + 1)};
+            if (!fn(view))
+              return visited;
+            visited++;
+          }
+        }
+        offset += recordBytes;
+      }
+    }
+    return visited;
+  }
+
+  // Re-export a time span as CSV rows (see `formatCsv`)
+  std::size_t exportCsv(int sensor, uint64_t t0, uint64_t t1, std::ostream& os)
+  {
+    std::vector<char> row;
+    return scan(sensor, t0, t1, [&](const RecordView& r) {
+      row.resize(csvBytes(*r.hdr));
+      char *end = formatCsv(row.data(), *r.hdr, r.columns);
+      os.write(row.data(), end - row.data());
+    });
+  }
+
+  std::size_t diskUsage()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    return _totalBytes;
+  }
+
+private:
+  std::string segmentPath(uint32_t n) const
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "seg-%u.bin", n);
+    return _dir + name;
+  }
+
+  std::string indexPath() const { return _dir + "index.bin"; }
+
+  static std::size_t fileSize(const std::string& path)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+      return 0;
+    return st.st_size;
+  }
+
+  bool writeAll(const void *buf, std::size_t len)
+  {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+      ssize_t n = ::write(_activeFd, p, len);
+      if (n < 0)
+        return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool openActive()
+  {
+    _activeFd = ::open(segmentPath(_active).c_str(),
+                       O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (_activeFd < 0)
+      return false;
+    _activeSize = fileSize(segmentPath(_active));
+    _segments[_active] = _activeSize;
+    return true;
+  }
+
+  //
+  // Cut the active (last) segment back to its last complete record, so a
+  // record torn by a crash is neither read past nor left in front of new
+  // appends. Returns whether anything was cut.
+  //
+  bool truncateTorn()
+  {
+    auto last = _segments.find(_active);
+    if (last == _segments.end() || last->second == 0)
+      return false;
+    std::size_t size = last->second;
+    const char *base = mapSegment(_active, size);
+    if (!base)
+      return false;
+    std::size_t valid = 0;
+    while (valid + sizeof(RecordHeader) <= size) {
+      const RecordHeader *hdr = (const RecordHeader *)(base + valid);
+      std::size_t recordBytes = sizeof(RecordHeader) +
+          sizeof(float) * hdr->channels * hdr->numSamples;
+      if (hdr->magic != kMagic || valid + recordBytes > size)
+        break;
+      valid += recordBytes;
+    }
+    unmapSegment(_active);
+    if (valid == size || truncate(segmentPath(_active).c_str(), valid) < 0)
+      return false;
+    _segments[_active] = valid;
+    _totalBytes -= size - valid;
+    return true;
+  }
+
+  // Seal the active segment and start a new one, enforcing the cap
+  bool rotate()
+  {
+    ::close(_activeFd);
+    _activeFd = -1;
+    _active++;
+    if (!openActive())
+      return false;
+    enforceCap();
+    return true;
+  }
+
+  // Drop the oldest sealed segments until the total fits the cap
+
+  void enforceCap()
+  {
+    bool dropped = false;
+    while (_totalBytes > _capBytes && _segments.size() > 1) {
+      auto oldest = _segments.begin();
+      unmapSegment(oldest->first);
+      unlink(segmentPath(oldest->first).c_str());
+      _totalBytes -= oldest->second;
+      uint32_t seg = oldest->first;
+      _segments.erase(oldest);
+      _index.erase(std::remove_if(_index.begin(), _index.end(),
+                                  [seg](const IndexEntry& e) {
+                                    return e.segment == seg;
+                                  }),
+                   _index.end());
+      dropped = true;
+    }
+    if (dropped)
+      rewriteIndex();
+  }
+
+  void loadIndex()
+  {
+    _index.clear();
+    FILE *fp = fopen(indexPath().c_str(), "rb");
+    if (!fp)
+      return;
+    IndexEntry e;
+    while (fread(&e, sizeof(e), 1, fp) == 1) {
+      auto seg = _segments.find(e.segment);
+      if (seg != _segments.end() && e.offset < seg->second)
+        _index.push_back(e);
+    }
+    fclose(fp);
+  }
+
+  void appendIndex(const IndexEntry& e)
+  {
+    FILE *fp = fopen(indexPath().c_str(), "ab");
+    if (!fp)
+      return;
+    fwrite(&e, sizeof(e), 1, fp);
+    fclose(fp);
+  }
+
+  void rewriteIndex()
+  {
+    std::string tmp = indexPath() + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+      return;
+    if (!_index.empty())
+      fwrite(_index.data(), sizeof(IndexEntry), _index.size(), fp);
+    fclose(fp);
+    rename(tmp.c_str(), indexPath().c_str());
+  }
+
+  //
+  // Sealed segments are mapped once and cached. The active segment keeps
+  // growing, so its mapping is refreshed whenever its size changed.
+  //
+  const char *mapSegment(uint32_t n, std::size_t size)
+  {
+    if (size == 0)
+      return nullptr;
+    auto it = _maps.find(n);
+    if (it != _maps.end()) {
+      if (it->second.second == size)
+        return (const char *)it->second.first;
+      munmap(it->second.first, it->second.second);
+      _maps.erase(it);
+    }
+    int fd = ::open(segmentPath(n).c_str(), O_RDONLY);
+    if (fd < 0)
+      return nullptr;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return nullptr;
+    _maps[n] = std::make_pair(p, size);
+    return (const char *)p;
+  }
+
+  void unmapSegment(uint32_t n)
+  {
+    auto it = _maps.find(n);
+    if (it == _maps.end())
+      return;
+    munmap(it->second.first, it->second.second);
+    _maps.erase(it);
+  }
+
+  std::mutex m;
+  std::string _dir;
+  std::size_t _capBytes;
+  std::size_t _segmentBytes;
+  uint32_t _indexStride;
+
+  uint32_t _active;
+  int _activeFd;
+  std::size_t _activeSize;
+  std::size_t _totalBytes;
+
+  std::map<uint32_t, std::size_t> _segments; // segment -> bytes
+  std::map<uint32_t, std::pair<void *, std::size_t>> _maps;
+  std::vector<IndexEntry> _index;
+  std::map<uint16_t, uint32_t> _sinceIndexed;
+  std::map<uint16_t, uint32_t> _indexedSegment;
+};
+
+#endif /* __ARCHIVE_H__ */
@@ -0,0 +1,235 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <cmath>
+#include <memory>
+
+#include "data.h"
+
+//
+// Trigger thresholds of one sensor, in its own units. `mag` is how far
+// the magnitude of a sample is from its slow moving average (so gravity
+// on the accelerometer does not count), `jerk` is the magnitude of the
+// change between two stored samples, per second.
+//
+// An event starts when either measure rises above its `high` threshold.
+// It is released once both fall below their `low` thresholds, and ends
+// after `postRollMs` without going above `high` again.
+//
+struct TriggerConfig {
+  float magHigh, magLow;
+  float jerkHigh, jerkLow;
+  float baselineAlpha; // EMA weight of the magnitude baseline
+  int postRollMs;
+};
+
+//
+// Event-triggered raw capture for sensor `S`.
+//
+// Stored-rate samples are fed one at a time, at `S::storedPeriod` or the
+// slower period given to `setPeriod`. The last `PRE` seconds are kept in
+// a fixed ring; when the trigger fires, the ring (pre-roll) and
+// every following sample up to the end of the post-roll are collected
+// into a `Segment`, which `feed` hands back once complete. Events longer
+// than `SEG` seconds are split into several segments.
+//
+// Not thread safe: meant to be driven from the sensor callback.
+//
+template <typename S, std::size_t PRE, std::size_t SEG>
+struct EventCapture {
+  static const std::size_t C = S::channels;
+  static const std::size_t R = PRE * 1000 / S::storedPeriod; // ring samples
+
+  typedef Measure<S, SEG> Segment;
+
+  static_assert(PRE < SEG,
+                "pre-roll must fit in a segment with room for the trigger");
+
+  enum State { IDLE, ACTIVE, POST_ROLL };
+
+  EventCapture() : _cfg(), _type(0), _period(S::storedPeriod), _ringCap(R)
+  {
+    reset();
+  }
+
+  void configure(const TriggerConfig& cfg, int type)
+  {
+    _cfg = cfg;
+    _type = type;
+  }
+
+  // ms between fed samples; call `reset` (or `flush`) first when changing
+  void setPeriod(int period)
+  {
+    if (period < S::storedPeriod || period % S::storedPeriod)
+      period = S::storedPeriod;
+    _period = period;
+    _ringCap = PRE * 1000 / _period;
+    if (_ringCap == 0)
+      _ringCap = 1;
+  }
+
+  void reset()
+  {
+    _state = IDLE;
+    _head = _count = 0;
+    _primed = false;
+    _baseline = 0;
+    _postLeft = 0;
+    _nextId = 0;
+    _events = 0;
+    _seg.reset();
+  }
+
+  //
+  // Feed one stored sample taken at `now` (s). Returns a completed
+  // segment, or nullptr.
+  //
+  std::unique_ptr<Segment> feed(const float *values, unsigned long long now)
+  {
+    std::unique_ptr<Segment> out;
+    bool hot, cold;
+    measure(values, hot, cold);
+
+    switch (_state) {
+    case IDLE:
+      ringPush(values);
+      if (hot) {
+        open(now);
+        ringDrain();
+        _events++;
+        _state = ACTIVE;
+      }
+      break;
+    case ACTIVE:
+      out = append(values, now);
+      if (cold) {
+        _postLeft = _cfg.postRollMs / _period;
+        _state = POST_ROLL;
+      }
+      break;
+    case POST_ROLL:
+      out = append(values, now);
+      if (hot) {
+        _state = ACTIVE;
+      } else if (--_postLeft <= 0) {
+        if (_seg && _seg->_numSamples() > 0)
+          out = std::move(_seg);
+        _seg.reset();
+        _state = IDLE;
+      }
+      break;
+    }
+    return out;
+  }
+
+  // Hand back the segment of an event still in progress, if any
+  std::unique_ptr<Segment> flush()
+  {
+    std::unique_ptr<Segment> out;
+    if (_seg && _seg->_numSamples() > 0)
+      out = std::move(_seg);
+    _seg.reset();
+    _state = IDLE;
+    _head = _count = 0;
+    return out;
+  }
+
+  // Events triggered since the last call
+  int takeEvents()
+  {
+    int n = _events;
+    _events = 0;
+    return n;
+  }
+
+  State state() const { return _state; }
+
+private:
+  void measure(const float *values, bool& hot, bool& cold)
+  {
+    float mag2 = 0, jerk2 = 0;
+    for (std::size_t c = 0; c < C; c++) {
+      mag2 += values[c] * values[c];
+      float d = _primed ? values[c] - _prev[c] : 0;
+      jerk2 += d * d;
+      _prev[c] = values[c];
+    }
+    float mag = std::sqrt(mag2);
+    float jerk = std::sqrt(jerk2) * 1000 / _period;
+    if (!_primed) {
+      _baseline = mag;
+      _primed = true;
+    }
+    float dev = std::fabs(mag - _baseline);
+
+    // Don't let an event pull the baseline towards itself
+    if (_state == IDLE)
+      _baseline += _cfg.baselineAlpha * (mag - _baseline);
+
+    hot = dev > _cfg.magHigh || jerk > _cfg.jerkHigh;
+    cold = dev < _cfg.magLow && jerk < _cfg.jerkLow;
+  }
+
+  void ringPush(const float *values)
+  {
+    for (std::size_t c = 0; c < C; c++)
+      _ring[c][_head] = values[c];
+    _head = (_head + 1) % _ringCap;
+    if (_count < _ringCap)
+      _count++;
+  }
+
+  // Move the ring, oldest first, into the new segment
+  void ringDrain()
+  {
+    float v[C];
+    std::size_t first = (_head + _ringCap - _count) % _ringCap;
+    for (std::size_t i = 0; i < _count; i++) {
+      for (std::size_t c = 0; c < C; c++)
+        v[c] = _ring[c][(first + i) % _ringCap];
+      _seg->push(v);
+    }
+    _head = _count = 0;
+  }
+
+  // `now` is the time of the newest ring sample
+  void open(unsigned long long now)
+  {
+    unsigned long long back = (unsigned long long)_count * _period / 1000;
+    _seg.reset(new Segment(_nextId++, _type, 0, now > back ? now - back : 0,
+                           0, _period, _period));
+    _seg->_kind = MEASURE_EVENT;
+  }
+
+  std::unique_ptr<Segment> append(const float *values, unsigned long long now)
+  {
+    std::unique_ptr<Segment> out;
+    if (!_seg)
+      open(now); // continuation of a long event
+    _seg->push(values);
+    if (_seg->_done)
+      out = std::move(_seg);
+    return out;
+  }
+
+  TriggerConfig _cfg;
+  int _type;
+  int _period;          // ms between fed samples
+  std::size_t _ringCap; // ring samples used at `_period`
+  State _state;
+
+  float _ring[C][R];
+  std::size_t _head, _count;
+
+  bool _primed;
+  float _prev[C];
+  float _baseline;
+
+  int _postLeft;
+  int _nextId;
+  int _events;
+  std::unique_ptr<Segment> _seg;
+};
+
+#endif /* __CAPTURE_H__ */
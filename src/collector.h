@@ -0,0 +1,920 @@
+#ifndef __COLLECTOR_H__
+#define __COLLECTOR_H__
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+#include <malloc.h>
+
+#include <dlog.h>
+#include <curl/curl.h>
+
+#include "platform.h"
+#include "loop.h"
+#include "queue.h"
+#include "sensors.h"
+#include "data.h"
+#include "capture.h"
+#include "archive.h"
+#include "http.h"
+#include "pipeline.h"
+#include "spill.h"
+#include "power.h"
+#include "recorder.h"
+#include "stream.h"
+#include "gps.h"
+#include "fetch.h"
+#include "idle.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "drunkare-debug"
+#endif
+
+#define DURATION 60 // seconds
+#define CONTEXT_DURATION 60 * 60 * 24 // seconds
+#define MAX_MEASURE_ID (CONTEXT_DURATION / DURATION)
+#define ARCHIVE_CAP_BYTES (64 * 1024 * 1024)
+#define DATA_URL "localhost:8080/data/"
+#define GPS_URL "localhost:8080/data/gps"
+#define MAX_IN_FLIGHT 8
+#define NET_BATCH 16 // windows taken from the queue per lock round trip
+#define PIPE_DEPTH 32 // payloads buffered between upload stages
+#define COMPRESS_UPLOADS 1
+#define MEMORY_BUDGET (4 * 1024 * 1024) // bytes of windows kept in memory
+#define RELOAD_PERIOD 5.0  // s between checks for spilled windows
+#define RELOAD_BATCH 4     // spilled windows brought back per check
+#define PRESSURE_HOLD 60   // s a low-memory warning is honoured without news
+#define EVENT_CAPTURE 1 // upload summaries plus raw segments around events
+#define PRE_ROLL 5        // seconds of raw data kept before an event
+#define EVENT_SEGMENT 30  // seconds per uploaded event segment
+#define RECORD_LOCAL 1 // keep every window in `pathname`, for offline sessions
+#define RECORD_FORMAT RECORD_CSV
+#define RECORD_ROTATE_BYTES (16 * 1024 * 1024)
+#define RECORD_MAX_FILES 16
+#define RECORD_SYNC_PERIOD 10.0 // s between fsyncs of the recording
+#define LIVE_STREAM 1 // also stream stored samples as they are taken
+#define STREAM_URL "localhost:8080/stream"
+#define STREAM_CHUNK_MS 250 // ms of samples per streamed chunk
+#define ADAPTIVE_GPS 1 // GPS period follows the wearer's motion (see gps.h)
+#define UPLOAD_PYRAMID 1 // upload windows as their 10 s and 60 s summaries
+#define FETCH_HOST "127.0.0.1" // where the server pulls detail (see fetch.h)
+#define FETCH_PORT 8081
+#define SUPPRESS_IDLE 1 // collapse still windows into idle runs (see idle.h)
+#define IDLE_RUN_MAX 60 // windows merged into one idle run at most
+
+// Upload queue priority classes (lower is served first)
+enum {
+  PRIO_LIVE,    // windows just completed by the sensors
+  PRIO_BACKLOG, // windows reloaded from the spill file
+  NUM_PRIORITIES
+};
+
+// Sensors we sample; their index in this list is the Measure `_type`
+using AppSensors = SensorList<Accelerometer, Gyroscope>;
+static const std::size_t NUM_SENSORS = AppSensors::size;
+
+template <typename S>
+using TMeasure = Measure<S, DURATION>;
+
+template <typename S>
+using MeasureDeque = std::deque<std::unique_ptr<TMeasure<S>>>;
+
+template <typename S>
+using TCapture = EventCapture<S, PRE_ROLL, EVENT_SEGMENT>;
+
+typedef Stage<MeasureBase, Payload, NUM_PRIORITIES> SerializeStage;
+typedef Stage<Payload, Payload> PayloadStage;
+
+// Event triggers, in `AppSensors` order (m/s^2 and deg/s)
+static const TriggerConfig triggers[NUM_SENSORS] = {
+  // magHigh magLow jerkHigh jerkLow alpha  postRollMs
+  {  6.f,    2.f,   200.f,   60.f,   0.02f, 5000 }, // Accelerometer
+  {  300.f,  100.f, 5000.f,  1500.f, 0.02f, 5000 }, // Gyroscope
+};
+
+// Noise floors below which a window is idle, in `AppSensors` order
+static const IdleFloor idleFloors[NUM_SENSORS] = {
+  // std    range
+  {  0.05f, 0.4f }, // Accelerometer
+  {  1.f,   8.f  }, // Gyroscope
+};
+
+//
+// The data path of the app, independent of the platform it runs on:
+// sensor samples are cut into windows (with event capture and the live
+// stream on the side), queued, and uploaded by the serialize, compress
+// and transmit stages; windows are also archived and recorded locally,
+// spilled to disk under memory pressure, and sampling, upload cadence,
+// GPS and CPU lock follow the power profile. While sampling, GPS also
+// follows the wearer's motion. Windows go out as coarse summaries; the
+// server pulls raw data and finer summaries from the archive through the
+// fetch server. Runs of idle windows are collapsed into one record.
+//
+// Device services come from a `Platform` and everything runs on `loop`
+// except the upload stages and the recorder, which have their own
+// threads. The owner calls `create` once the loop is up, `destroy`
+// before it goes away, and forwards the platform's low-battery and
+// low-memory events.
+//
+struct Collector {
+  Collector(Loop& loop, Platform& platform)
+      : _loop(loop), _platform(platform), _isMeasuring(false), _context(0),
+        _locationWanted(false) {}
+
+  Collector(const Collector&) = delete;
+  Collector& operator=(const Collector&) = delete;
+
+  // Set before `create`
+  std::string dataUrl = DATA_URL;
+  std::string gpsUrl = GPS_URL;
+  std::string streamUrl = STREAM_URL;
+  std::string fetchHost = FETCH_HOST;
+  int fetchPort = FETCH_PORT; // 0: no fetch server
+
+  std::function<void()> onStopped; // measurement ended, e.g. all windows done
+  std::function<void(double, double)> onPosition; // latitude, longitude
+
+  // Open local storage and network clients; follow the battery from here
+  void create()
+  {
+    http.reset(new HttpEngine(_loop, MAX_IN_FLIGHT));
+    http->onComplete = httpCompletedCb;
+    // A new session per run: the server resumes a stream within a session
+    stream.reset(new StreamClient(_loop, streamUrl, 0 /* dummy user_id */,
+                                  (uint64_t)time(nullptr)));
+
+    // Pick the power profile from the current battery state, then follow it
+    _profile = power.update(_platform.batteryPercent(),
+                            _platform.batteryCharging());
+    uploadCadence.setPeriod(powerProfiles[_profile].uploadPeriod);
+    _platform.watchBattery(batteryChangedCb, this);
+
+    // Initialize per-sensor measure IDs
+    _measureId.assign(NUM_SENSORS, 0);
+    _doneMeasureId.assign(NUM_SENSORS, -1);
+
+    filepath = _platform.dataPath();
+    pathname = filepath + std::string(
+        RECORD_FORMAT == RECORD_CSV ? "data.csv" : "data.bin");
+    if (!archive.open(filepath + std::string("archive"), ARCHIVE_CAP_BYTES)) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] archive.open() failed");
+    }
+    if (fetchPort) {
+      fetch.reset(new FetchServer<AppSensors>(_loop, archive,
+                                              DURATION * IDLE_RUN_MAX));
+      if (!fetch->open(fetchHost.c_str(), fetchPort))
+        dlog_print(DLOG_ERROR, LOG_TAG, "[-] fetch->open() failed");
+    }
+    if (!memory.open(filepath + std::string("spill.bin"), MEMORY_BUDGET,
+                     unspillMeasure)) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] memory.open() failed");
+    }
+    RecorderOptions recordOpt;
+    recordOpt.format = RECORD_FORMAT;
+    recordOpt.rotateBytes = RECORD_ROTATE_BYTES;
+    recordOpt.maxFiles = RECORD_MAX_FILES;
+    recordOpt.syncPeriod = RECORD_SYNC_PERIOD;
+    if (!recorder.open(pathname, recordOpt)) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] recorder.open() failed");
+      _record = false;
+    }
+  }
+
+  void destroy()
+  {
+    // `stop` joins the pipeline stages, so nothing posts to `http` after it
+    if (_isMeasuring)
+      stop();
+    stopLocation();
+    _platform.unwatchBattery();
+    fetch.reset();
+    stream.reset();
+
+    // Uploads still queued or in flight are dropped; their windows stay
+    // in the archive
+    http->flush();
+    if (std::size_t left = http->busy()) {
+      dlog_print(DLOG_WARN, LOG_TAG, "[-] dropping %zu unfinished uploads",
+                 left);
+    }
+    http.reset();
+  }
+
+  bool measuring() const { return _isMeasuring; }
+
+  void start(int context)
+  {
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] startMeasurement()");
+
+    /* NOTE that is is very less likely to be here, since we disable
+       button while measuring */
+    if (_isMeasuring) {
+      /* sensor servuce is already running */
+      dlog_print(DLOG_WARN, LOG_TAG,
+                 "[-] startMeasurement() is invoked while sensor service is already running");
+      return;
+    }
+
+    _context = context;
+    queue.clear();
+
+    const PowerProfile& p = powerProfiles[_profile];
+    setCpuLock(p.cpuLock);
+
+    // Create upload threads here
+    if (!startUploadPipeline()) {
+      setCpuLock(false);
+      return;
+    }
+
+    // Every sensor is polled at its own device rate (see sensors.h), slowed
+    // down by the power profile
+    forEachSensor<AppSensors>([this, &p](auto i) {
+      using S = SensorAt<decltype(i)::value, AppSensors>;
+      auto& capture = std::get<decltype(i)::value>(captures);
+      capture.reset();
+      capture.configure(triggers[i], i);
+      capture.setPeriod(S::storedPeriod * p.storedScale);
+      auto& chunker = std::get<decltype(i)::value>(chunkers);
+      chunker.reset();
+      chunker.chunkMs = STREAM_CHUNK_MS;
+      auto& idle = std::get<decltype(i)::value>(idleRuns);
+      idle.floor = idleFloors[i];
+      idle.maxWindows = IDLE_RUN_MAX;
+      if (!_platform.startSensor(i, S::devicePeriod * p.deviceScale,
+                                 sampleCb<decltype(i)::value>, this)) {
+        dlog_print(DLOG_ERROR, LOG_TAG, "[-] failed to start sensor %zu",
+                   (std::size_t)i);
+      }
+    });
+    _isMeasuring = true;
+    if (_stream)
+      stream->start();
+
+    // Spilled windows, including any left over from an earlier run, are
+    // brought back from here
+    memoryTimer = _loop.addTimer(RELOAD_PERIOD, memoryTimerCb, this);
+  }
+
+  void stop()
+  {
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] stopMeasurement()");
+
+    if (!_isMeasuring) {
+      /* sensor servuce is NOT running */
+      dlog_print(DLOG_WARN, LOG_TAG,
+                 "[-] stopMeasurement() is invoked while sensor service is not running");
+      return;
+    }
+
+    _isMeasuring = false;
+
+    setCpuLock(false);
+
+    if (memoryTimer) {
+      _loop.delTimer(memoryTimer);
+      memoryTimer = nullptr;
+    }
+
+    for (std::size_t i = 0; i < NUM_SENSORS; i++) {
+      _platform.stopSensor(i);
+    }
+
+    // Hand over partially filled windows too, then let the pipeline drain
+    // everything that is still queued before it exits
+    flushWindows();
+    stopUploadPipeline();
+    flushStream();
+    if (_stream)
+      stream->stop();
+
+    for (std::size_t i = 0; i < _measureId.size(); i++) {
+      _measureId[i] = 0;
+      _doneMeasureId[i] = -1;
+    }
+
+    // Without samples the motion is unknown: back to the profile's period
+    gps.reset();
+    applyLocation();
+
+    if (onStopped)
+      onStopped();
+  }
+
+  //
+  // GPS fixes at the period of the power profile, which may turn them
+  // off, adjusted to the wearer's motion while measuring
+  //
+  void startLocation()
+  {
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] start_location_service()");
+    _locationWanted = true;
+    if (powerProfiles[_profile].gpsPeriod == 0) {
+      /* GPS is off in this power profile */
+      dlog_print(DLOG_INFO, LOG_TAG, "[-] location service disabled by power profile");
+    }
+    applyLocation();
+  }
+
+  void stopLocation()
+  {
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] stop_location_service()");
+    _locationWanted = false;
+    _platform.stopLocation();
+    _gpsPeriod = 0;
+  }
+
+  //
+  // Switch to power profile `profile`: sampling rates (windows in progress
+  // are closed so each window has a single rate), upload cadence, GPS
+  // period and CPU lock.
+  //
+  void applyProfile(int profile)
+  {
+    if (profile == _profile)
+      return;
+    const PowerProfile& p = powerProfiles[profile];
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] power profile %s -> %s",
+               powerProfiles[_profile].name, p.name);
+
+    if (_isMeasuring) {
+      flushWindows();
+      flushStream();
+    }
+    _profile = profile;
+    uploadCadence.setPeriod(p.uploadPeriod);
+
+    if (_isMeasuring) {
+      applySensorRates();
+      setCpuLock(p.cpuLock);
+    }
+
+    applyLocation();
+  }
+
+  // The platform reported a low battery
+  void lowBattery() { applyProfile(power.lowBattery()); }
+
+  //
+  // The platform reported memory pressure (`warning`) or that it is over.
+  // Under pressure everything queued goes to disk now, and stays there
+  // until the pressure is gone; spilled windows then come back through
+  // `memoryTimerCb`.
+  //
+  void lowMemory(bool warning)
+  {
+    if (!warning) {
+      memory.setPressure(false);
+      return;
+    }
+    dlog_print(DLOG_WARN, LOG_TAG, "[-] low memory, %zu bytes of windows held",
+               memory.bytes());
+    memory.setPressure(true);
+    _pressureSince = std::chrono::steady_clock::now();
+    spillQueued(0);
+    shrinkCaches();
+  }
+
+  // Sampling state
+  AppSensors::map<MeasureDeque> tMeasures; // one deque per sensor
+  AppSensors::map<TCapture> captures;      // event capture per sensor
+  bool _captureEvents = EVENT_CAPTURE;
+  Queue<MeasureBase, NUM_PRIORITIES> queue;
+  AppSensors::map<IdleSuppressor> idleRuns; // idle windows being merged
+  bool _suppressIdle = SUPPRESS_IDLE;
+
+  // Upload pipeline: queue -> serialize -> compress -> transmit
+  Queue<Payload> serialized{PIPE_DEPTH};
+  Queue<Payload> compressed{PIPE_DEPTH};
+  std::unique_ptr<SerializeStage> serializeStage;
+  std::unique_ptr<PayloadStage> compressStage;
+  std::unique_ptr<PayloadStage> transmitStage;
+  Credits sendCredits{2 * MAX_IN_FLIGHT}; // uploads handed to `http`
+  bool _compress = COMPRESS_UPLOADS;
+
+  Cadence uploadCadence; // upload bursts, set by the power profile
+
+  Recorder recorder; // windows written to `pathname` by its own thread
+  bool _record = RECORD_LOCAL;
+
+  MemoryGovernor memory; // windows held in memory, spilled when over
+  void *memoryTimer = nullptr;
+  std::chrono::steady_clock::time_point _pressureSince;
+
+  PowerGovernor power; // picks `_profile` from the battery state
+  int _profile = PROFILE_FULL;
+  bool _cpuLocked = false;
+
+  std::string filepath;
+  std::string pathname;
+  Archive archive; // local copy of every completed window
+  std::unique_ptr<FetchServer<AppSensors>> fetch; // serves `archive`
+  bool _uploadPyramid = UPLOAD_PYRAMID;
+
+  std::unique_ptr<HttpEngine> http; // shared by data and GPS uploads
+
+  // Live stream: sub-second chunks of stored samples (see stream.h)
+  std::unique_ptr<StreamClient> stream;
+  AppSensors::map<StreamChunker> chunkers;
+  bool _stream = LIVE_STREAM;
+
+  GpsScheduler gps; // GPS period and method from the accelerometer
+  bool _adaptiveGps = ADAPTIVE_GPS;
+  int _gpsPeriod = 0; // s, as the location manager runs now; 0: stopped
+  int _gpsMethod = LOCATION_HYBRID;
+
+private:
+  void setCpuLock(bool lock)
+  {
+    if (lock == _cpuLocked)
+      return;
+    _platform.setCpuLock(lock);
+    _cpuLocked = lock;
+  }
+
+  //
+  // Hand over the windows being filled (if they hold anything) and any
+  // event segment in progress, e.g. when stopping or when the sampling
+  // rates change.
+  //
+  void flushWindows()
+  {
+    forEachSensor<AppSensors>([this](auto i) {
+      auto& windows = std::get<decltype(i)::value>(tMeasures);
+      auto& capture = std::get<decltype(i)::value>(captures);
+      for (auto& tMeasure : windows) {
+        tMeasure->_events = capture.takeEvents();
+        if (tMeasure->_numSamples() > 0)
+          closeWindow<decltype(i)::value>(std::move(tMeasure));
+        else
+          memory.held(-(std::ptrdiff_t)tMeasure->_bytes());
+      }
+      windows.clear();
+      endIdleRun<decltype(i)::value>();
+      if (auto segment = capture.flush()) {
+        segment->_context = _context;
+        segment->_profile = _profile;
+        memory.held(segment->_bytes());
+        queue.enqueue(std::move(segment), PRIO_LIVE);
+      }
+    });
+  }
+
+  //
+  // A window of the `I`-th sensor is complete: fold it into the idle run
+  // if it is idle, otherwise queue the run it ends (if any) and then it
+  //
+  template <std::size_t I>
+  void closeWindow(std::unique_ptr<TMeasure<SensorAt<I, AppSensors>>> w)
+  {
+    auto& idle = std::get<I>(idleRuns);
+    if (_suppressIdle && idle.absorb(*w)) {
+      memory.held(-(std::ptrdiff_t)w->_bytes());
+      if (idle.full())
+        endIdleRun<I>();
+      return;
+    }
+    endIdleRun<I>();
+    archiveMeasure(*w);
+    queue.enqueue(std::move(w), PRIO_LIVE);
+  }
+
+  template <std::size_t I>
+  void endIdleRun()
+  {
+    if (auto run = std::get<I>(idleRuns).take()) {
+      archiveMeasure(*run);
+      memory.held(run->_bytes());
+      queue.enqueue(std::move(run), PRIO_LIVE);
+    }
+  }
+
+  //
+  // Keep a local copy as soon as a record closes, so nothing is lost if
+  // the upload fails. Archiving here rather than in the pipeline keeps
+  // each sensor's records in time order (as `Archive::scan` expects) even
+  // when queued ones are spilled and reloaded later.
+  //
+  void archiveMeasure(const MeasureBase& m)
+  {
+    if (!archive.append(m)) {
+      dlog_print(DLOG_WARN, LOG_TAG, "[-] archive.append() failed (id=%d)",
+                 m._id);
+    }
+  }
+
+  static uint64_t wallClockUs()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  // Send what the stream chunkers hold, e.g. before the rates change
+  void flushStream()
+  {
+    if (!_stream)
+      return;
+    const PowerProfile& p = powerProfiles[_profile];
+    forEachSensor<AppSensors>([this, &p](auto i) {
+      using S = SensorAt<decltype(i)::value, AppSensors>;
+      auto& chunker = std::get<decltype(i)::value>(chunkers);
+      if (!chunker.empty())
+        stream->send(chunker.take(i, S::storedPeriod * p.storedScale));
+    });
+  }
+
+  // Listener interval and capture rate of every sensor under `_profile`
+  void applySensorRates()
+  {
+    const PowerProfile& p = powerProfiles[_profile];
+    forEachSensor<AppSensors>([this, &p](auto i) {
+      using S = SensorAt<decltype(i)::value, AppSensors>;
+      std::get<decltype(i)::value>(captures).setPeriod(
+          S::storedPeriod * p.storedScale);
+      _platform.setSensorPeriod(i, S::devicePeriod * p.deviceScale);
+    });
+  }
+
+  // Start, retune or stop location updates as planned for `_profile`
+  void applyLocation()
+  {
+    int base = powerProfiles[_profile].gpsPeriod;
+    GpsPlan plan = _adaptiveGps ? gps.plan(base)
+                                : GpsPlan{base, LOCATION_HYBRID};
+    if (!_locationWanted)
+      plan.period = 0;
+    if (plan.period == _gpsPeriod &&
+        (plan.period == 0 || plan.method == _gpsMethod))
+      return;
+
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] GPS every %d s (%s)", plan.period,
+               plan.method == LOCATION_GPS ? "gps" : "hybrid");
+    if (plan.period == 0) {
+      _platform.stopLocation();
+    } else if (!_platform.startLocation(plan.period, plan.method,
+                                        positionUpdatedCb, this)) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] failed to start location service");
+      plan.period = 0;
+    }
+    _gpsPeriod = plan.period;
+    _gpsMethod = plan.method;
+  }
+
+  static void batteryChangedCb(int percent, bool charging, void *data)
+  {
+    Collector *self = (Collector *)data;
+    self->applyProfile(self->power.update(percent, charging));
+  }
+
+  //
+  // Sample callback of the `I`-th sensor in `AppSensors`. One instance is
+  // generated per sensor, so the sensor type is known statically here.
+  //
+  template <std::size_t I>
+  static void sampleCb(const float *values, void *data)
+  {
+    using S = SensorAt<I, AppSensors>;
+    Collector *self = (Collector *)data;
+    auto& windows = std::get<I>(self->tMeasures);
+    auto& capture = std::get<I>(self->captures);
+
+    // Check tMeasures deque
+    if (windows.empty()) {
+      const PowerProfile& p = powerProfiles[self->_profile];
+      unsigned long long timestamp = (unsigned long long)time(nullptr);
+      windows.push_back(
+          std::make_unique<TMeasure<S>>(self->_measureId[I]++,
+                                        I, self->_context, timestamp, 0,
+                                        S::devicePeriod * p.deviceScale,
+                                        S::storedPeriod * p.storedScale));
+      windows.back()->_profile = self->_profile;
+      self->memory.held(windows.back()->_bytes());
+    }
+
+    // Tick (store values in Measure.data every periods); every stored
+    // sample also goes to the live stream and through the event trigger
+    if (windows.front()->tick(values)) {
+      auto& chunker = std::get<I>(self->chunkers);
+      if (self->_stream && chunker.add(values, wallClockUs())) {
+        self->stream->send(chunker.take(I, windows.front()->_storedPeriod));
+      }
+
+      if (S::native == SENSOR_ACCELEROMETER && self->_adaptiveGps &&
+          self->gps.feed(values, windows.front()->_storedPeriod)) {
+        self->applyLocation();
+      }
+
+      if (self->_captureEvents) {
+        auto segment = capture.feed(values,
+                                    (unsigned long long)time(nullptr));
+        if (segment) {
+          segment->_context = self->_context;
+          segment->_profile = self->_profile;
+          self->memory.held(segment->_bytes());
+          self->queue.enqueue(std::move(segment), PRIO_LIVE);
+        }
+      }
+    }
+
+    // Check Measure->_done and enqueue
+    if (windows.front()->_done) {
+      self->_doneMeasureId[I] = windows.front()->_id;
+      windows.front()->_events = capture.takeEvents();
+
+      self->closeWindow<I>(std::move(windows.front()));
+      windows.pop_front();
+
+      // Uploads can't keep up (e.g. offline): move the backlog to disk
+      if (self->memory.overBudget())
+        self->spillQueued(self->memory.budget() * 3 / 4);
+
+      // Check termination condition
+      if (self->_doneMeasureId[I] >= MAX_MEASURE_ID) {
+        bool allFinished = true;
+
+        for (auto doneId : self->_doneMeasureId) {
+          allFinished &= (doneId >= MAX_MEASURE_ID);
+        }
+
+        if (allFinished) {
+          self->stop();
+          return;
+        }
+      }
+    }
+  }
+
+  static void positionUpdatedCb(double latitude, double longitude,
+                                double altitude, time_t timestamp, void *data)
+  {
+    Collector *self = (Collector *)data;
+
+    dlog_print(DLOG_DEBUG, LOG_TAG, "[%ld] lat[%f] lon[%f] alt[%f]",
+               (long)timestamp, latitude, longitude, altitude);
+    self->gps.fixed();
+    if (self->onPosition)
+      self->onPosition(latitude, longitude);
+
+    /*
+     * Let's do CURL! (asynchronously, on the main loop) ======
+     */
+    unsigned long long curl_timestamp = (unsigned long long)time(nullptr); // Hack!
+
+    std::ostringstream oss;
+    oss << "{\"timestamp\":" << curl_timestamp << ","
+        << "\"user_id\":0," /* dummy user_id */
+        << "\"latitude\":" << std::setprecision(8) << latitude << ","
+        << "\"longitude\":" << std::setprecision(8) << longitude << "}";
+
+    // {url}:{port}/location
+    HttpRequest req;
+    req.url = self->gpsUrl;
+    req.body = oss.str();
+    self->http->submit(std::move(req));
+  }
+
+  static void httpCompletedCb(const HttpRequest& req, const HttpResult& res)
+  {
+    if (!res.ok()) {
+      dlog_print(DLOG_WARN, LOG_TAG, "[-] POST %s failed (attempt %d, curl=%d, http=%ld)",
+                 req.url.c_str(), req.attempt, res.code, res.status);
+    }
+  }
+
+  //
+  // Upload pipeline stages, each on its own thread (see pipeline.h):
+  //   serialize  take `Measure`s from `queue` (up to `NET_BATCH` per lock
+  //              round trip), append windows and idle runs to the
+  //              recording (`closeWindow` archived them already), and
+  //              format the POST body: the
+  //              window's coarse summaries, or without those the raw
+  //              window, or in event-capture mode its summary (event
+  //              segments always go out raw, idle runs as they are)
+  //   compress   gzip large bodies
+  //   transmit   hand the POST to `http`, which runs it on the main loop;
+  //              at most `sendCredits` uploads are outstanding, so a slow
+  //              network backs up into the bounded stage queues
+  //
+  std::unique_ptr<Payload>
+  serializeMeasure(std::unique_ptr<MeasureBase> tMeasure)
+  {
+    // The archive is capped; the recording keeps the whole session.
+    // Event segments are copies of recorded windows, so skip them.
+    if (_record && tMeasure->_kind != MEASURE_EVENT)
+      recorder.record(*tMeasure);
+
+    std::unique_ptr<Payload> payload(new Payload());
+    payload->id = tMeasure->_id;
+    payload->type = tMeasure->_type;
+    if (_uploadPyramid && tMeasure->_kind == MEASURE_WINDOW)
+      payload->body = tMeasure->formatPyramidJson();
+    else if (_captureEvents && tMeasure->_kind == MEASURE_WINDOW)
+      payload->body = tMeasure->formatSummaryJson();
+    else
+      payload->body = tMeasure->formatJson();
+    memory.held(-(std::ptrdiff_t)tMeasure->_bytes());
+    return payload;
+  }
+
+  std::unique_ptr<Payload> compressPayload(std::unique_ptr<Payload> payload)
+  {
+    if (_compress)
+      gzipPayload(*payload);
+    else
+      payload->rawBytes = payload->body.size();
+    return payload;
+  }
+
+  std::unique_ptr<Payload> transmitPayload(std::unique_ptr<Payload> payload)
+  {
+    transmitStage->blockedFor(uploadCadence.wait());
+    transmitStage->blockedFor(sendCredits.acquire());
+
+    // {url}:{port}/data
+    HttpRequest req;
+    req.url = dataUrl;
+    req.body = std::move(payload->body);
+    req.contentType = payload->contentType;
+    req.contentEncoding = payload->contentEncoding;
+    req.done = [this](const HttpRequest&, const HttpResult&) {
+      sendCredits.release();
+    };
+    http->post(std::move(req));
+
+    // Nothing left anywhere upstream: the radio can sleep until next burst
+    if (compressed.size() == 0 && serialized.size() == 0 && queue.size() == 0)
+      uploadCadence.burstDone();
+    return nullptr;
+  }
+
+  bool startUploadPipeline()
+  {
+    serialized.clear();
+    compressed.clear();
+    sendCredits.reopen();
+    uploadCadence.reopen();
+
+    if (_record && !recorder.start())
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] failed to start recorder");
+
+    serializeStage.reset(new SerializeStage(
+        "serialize", queue, &serialized,
+        [this](std::unique_ptr<MeasureBase> m) {
+          return serializeMeasure(std::move(m));
+        }, NET_BATCH));
+    compressStage.reset(new PayloadStage(
+        "compress", serialized, &compressed,
+        [this](std::unique_ptr<Payload> p) {
+          return compressPayload(std::move(p));
+        }));
+    transmitStage.reset(new PayloadStage(
+        "transmit", compressed, nullptr,
+        [this](std::unique_ptr<Payload> p) {
+          return transmitPayload(std::move(p));
+        }));
+
+    if (!transmitStage->start() || !compressStage->start() ||
+        !serializeStage->start()) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "[-] failed to start upload pipeline");
+      queue.forceDone();
+      serialized.forceDone();
+      compressed.forceDone();
+      serializeStage.reset();
+      compressStage.reset();
+      transmitStage.reset();
+      recorder.stop();
+      return false;
+    }
+    return true;
+  }
+
+  template <typename St>
+  static void logStage(const St& stage)
+  {
+    const StageMetrics& m = stage.metrics;
+    dlog_print(DLOG_INFO, LOG_TAG,
+               "[+] stage %s: %llu items, utilization %.2f "
+               "(busy %.1f s, waiting for input %.1f s, for output %.1f s)",
+               stage.name, (unsigned long long)m.items.load(), m.utilization(),
+               m.busyUs / 1e6, m.waitInUs / 1e6, m.waitOutUs / 1e6);
+  }
+
+  //
+  // Let every stage finish what is queued, then join them. Runs on the
+  // main loop, which therefore can't complete uploads meanwhile: transmit
+  // stops waiting for credits.
+  //
+  void stopUploadPipeline()
+  {
+    sendCredits.drain();
+    uploadCadence.drain();
+    queue.drainDone();
+    serializeStage->join();
+    compressStage->join();
+    transmitStage->join();
+
+    logStage(*serializeStage);
+    logStage(*compressStage);
+    logStage(*transmitStage);
+    serializeStage.reset();
+    compressStage.reset();
+    transmitStage.reset();
+
+    // Everything serialized is recorded by now: write it out and sync
+    recorder.stop();
+    dlog_print(DLOG_INFO, LOG_TAG,
+               "[+] recorder: %llu windows, %llu bytes, %llu rotations, "
+               "%llu syncs, %llu write errors",
+               (unsigned long long)recorder.records(),
+               (unsigned long long)recorder.bytes(),
+               (unsigned long long)recorder.files(),
+               (unsigned long long)recorder.syncs(),
+               (unsigned long long)recorder.writeErrors());
+  }
+
+  //
+  // Memory governor glue (see spill.h). Everything below runs on the main
+  // loop; the serialize stage only reports the windows it frees.
+  //
+
+  // `MemoryGovernor::Factory`: recreate a spilled window of `AppSensors`
+  static std::unique_ptr<MeasureBase>
+  unspillMeasure(const Archive::RecordHeader& hdr, const float *columns,
+                 int kind)
+  {
+    std::unique_ptr<MeasureBase> m;
+    forEachSensor<AppSensors>([&](auto i) {
+      using S = SensorAt<decltype(i)::value, AppSensors>;
+      if (hdr.sensor != i)
+        return;
+      if (kind == MEASURE_EVENT)
+        m = unspill<typename TCapture<S>::Segment>(hdr, columns, kind);
+      else if (kind == MEASURE_IDLE)
+        m = IdleRun<S>::unspill(hdr, columns);
+      else
+        m = unspill<TMeasure<S>>(hdr, columns, kind);
+    });
+    return m;
+  }
+
+  // Give back what allocators and caches hold on to beyond live windows
+  void shrinkCaches()
+  {
+    archive.trimCache();
+    malloc_trim(0);
+  }
+
+  void spillQueued(std::size_t target)
+  {
+    std::size_t n = memory.spill(queue, target);
+    if (n) {
+      dlog_print(DLOG_INFO, LOG_TAG,
+                 "[+] spilled %zu windows (%zu bytes held, %zu on disk)", n,
+                 memory.bytes(), memory.spilledBytes());
+    }
+  }
+
+  //
+  // Periodic check while measuring: keep spilling while the OS reports
+  // pressure, otherwise bring spilled windows back once the queue is
+  // nearly empty.
+  //
+  static bool memoryTimerCb(void *data)
+  {
+    Collector *self = (Collector *)data;
+    if (!self->_isMeasuring) {
+      self->memoryTimer = nullptr;
+      return false;
+    }
+
+    if (self->memory.underPressure() &&
+        std::chrono::steady_clock::now() - self->_pressureSince >
+            std::chrono::seconds(PRESSURE_HOLD)) {
+      self->memory.setPressure(false);
+    }
+
+    if (self->memory.underPressure())
+      self->spillQueued(0);
+    else if (self->queue.size() < RELOAD_BATCH)
+      self->memory.reload(self->queue, RELOAD_BATCH, PRIO_BACKLOG);
+    return true;
+  }
+
+  Loop& _loop;
+  Platform& _platform;
+
+  bool _isMeasuring;
+  int _context;
+  bool _locationWanted; // started by the app; the profile may pause it
+  std::vector<int> _measureId;
+  std::vector<int> _doneMeasureId;
+};
+
+#endif /* __COLLECTOR_H__ */
@@ -1,117 +1,299 @@
+#ifndef __DATA_H__
+#define __DATA_H__
+
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <cmath>
 
-//
-// This stores data from sensor with `C` channels for `D` seconds.
-// TODO: Preprocessing?
-//
-template <std::size_t C, std::size_t D>
-struct Measure {
-  static const int _samplingPeriod = 40;       // ms
-  static const int _deviceSamplingPeriod = 10; // ms
+#include "pyramid.h"
 
-  constexpr std::size_t _numChannels() { return C; }
-  constexpr std::size_t _duration() { return D; }
+// What a `Measure` holds
+enum {
+  MEASURE_WINDOW, // one fixed-length window of the continuous stream
+  MEASURE_EVENT,  // raw samples around a triggered event (see capture.h)
+  MEASURE_IDLE,   // a run of idle windows, collapsed (see idle.h)
+};
 
+//
+// Sensor-independent part of a window, so windows of different sensors
+// can share a queue, the archive and the upload path. Only cold paths
+// (serialization, storage) go through the virtual accessors; `tick` is
+// resolved statically on the concrete `Measure`.
+//
+struct MeasureBase {
   int _id;
   int _type;
   int _context;
+  int _userId;
+  int _kind;    // MEASURE_WINDOW, MEASURE_EVENT or MEASURE_IDLE
+  int _events;  // events triggered while this window was recorded
+  int _profile; // power profile it was recorded under (see power.h)
   size_t _tick, _nextIdx; // tick: deviceSamplingPeriod, nextIdx: samplingPeriod
   bool _done;
   unsigned long long _timestamp;
-  float data[C][D * 1000 / _samplingPeriod];
 
-  Measure(int id, int type, int context, unsigned long long timestamp)
-    : _id(id), _type(type), _context(context), _tick(0),
-      _nextIdx(0), _done(false),_timestamp(timestamp) {}
+  MeasureBase(int id, int type, int context, unsigned long long timestamp,
+              int userId)
+    : _id(id), _type(type), _context(context), _userId(userId),
+      _kind(MEASURE_WINDOW), _events(0), _profile(0), _tick(0), _nextIdx(0),
+      _done(false), _timestamp(timestamp) {}
 
-  constexpr size_t _size() {
-    return 4 + C * D * 1000 / _samplingPeriod;
-  }
+  virtual ~MeasureBase() {}
 
   size_t _numSamples() const
   {
     return _nextIdx;
   }
 
-  std::string format()
+  virtual std::size_t _numChannels() const = 0;
+  virtual int _period() const = 0; // ms between stored samples
+  virtual const float *_channel(std::size_t c) const = 0;
+  virtual std::size_t _bytes() const = 0; // memory held by this window
+
+  virtual std::string format() = 0;
+  virtual std::string formatJson() = 0;
+  virtual std::string formatSummaryJson() = 0;
+  virtual std::string formatPyramidJson() = 0;
+
+  const char *_kindName() const
+  {
+    return _kind == MEASURE_EVENT ? "event" :
+           _kind == MEASURE_IDLE ? "idle" : "window";
+  }
+};
+
+//
+// This stores data from sensor `S` (see sensors.h) for `D` seconds. The
+// buffer is sized for the sensor's own (fastest) stored rate; a window
+// can be recorded at a slower rate (see power.h) by passing longer
+// periods, which must be multiples of the sensor's.
+//
+// Stored samples also feed `_summary`, the window's 10 s and 60 s
+// summaries (see pyramid.h), aligned to `_timestamp`.
+// TODO: Preprocessing?
+//
+template <typename S, std::size_t D>
+struct Measure : MeasureBase {
+  static const std::size_t C = S::channels;
+  static const int _samplingPeriod = S::storedPeriod;       // ms, fastest
+  static const int _deviceSamplingPeriod = S::devicePeriod; // ms, fastest
+  static const std::size_t N = D * 1000 / _samplingPeriod;  // samples
+
+  static_assert(_samplingPeriod % _deviceSamplingPeriod == 0,
+                "stored period must be a multiple of the device period");
+
+  constexpr std::size_t _duration() { return D; }
+
+  int _storedPeriod;     // ms, of this window
+  int _devicePeriod;     // ms, of this window
+  std::size_t _capacity; // samples in a full window at `_storedPeriod`
+
+  float data[C][N];
+  SummaryPyramid<C> _summary;
+
+  Measure(int id, int type, int context, unsigned long long timestamp,
+          int userId = 0, int devicePeriod = _deviceSamplingPeriod,
+          int storedPeriod = _samplingPeriod)
+    : MeasureBase(id, type, context, timestamp, userId),
+      _storedPeriod(storedPeriod), _devicePeriod(devicePeriod)
+  {
+    if (_storedPeriod < _samplingPeriod || _storedPeriod % _samplingPeriod)
+      _storedPeriod = _samplingPeriod;
+    if (_devicePeriod <= 0 || _storedPeriod % _devicePeriod)
+      _devicePeriod = _storedPeriod;
+    _capacity = D * 1000 / _storedPeriod;
+    _summary.reset(timestamp * 1000);
+  }
+
+  constexpr size_t _size() {
+    return 4 + C * N;
+  }
+
+  std::size_t _numChannels() const override { return C; }
+  int _period() const override { return _storedPeriod; }
+  const float *_channel(std::size_t c) const override { return data[c]; }
+  std::size_t _bytes() const override { return sizeof(*this); }
+
+  std::string format() override
   {
     std::ostringstream oss;
+    std::size_t numSample = _numSamples();
     oss << _id << ',' << _context << ',' << _type << ',';
-    for (int c = 0; c < _numChannels(); c++) {
-      for (float val : data[c]) {
-        oss << val << ',';
+    for (std::size_t c = 0; c < C; c++) {
+      for (std::size_t j = 0; j < numSample; j++) {
+        oss << data[c][j] << ',';
       }
     }
     std::string s = oss.str();
     return s.substr(0, s.size()-1);
   }
 
-  std::string formatJson()
+  std::string formatJson() override
   {
     int numSample = _numSamples();
-    std::string sensor_type = "";
-
-    // Check the Measure type (accel or gyro)
-    switch (_type) {
-	    case 0:
-	    	sensor_type = "accel";
-	    	break;
-	    case 1:
-	    	sensor_type = "gyro";
-	    	break;
-	    default:
-	    	break;
-	 }
-
-	 // JSON ormatting
-	 std::string timestamps = std::to_string(_timestamp);
-	 std::string data[C] = {"", "", ""}; // data[0] = "10.0, 5.0, 2.0, ..."
-
-	 for (unsigned int i = 0; i < C; i++) {
-	   for (int j = 0; j < numSample; j++) {
-	     data[i] += std::to_string(this->data[i][j]);
-	     if (j < numSample-1)
-	       data[i] += ",";
-	   }
-	 }
-
-         /* NOTE: Hardcoded user_id */
-	 std::string jsonObj = "{\"user_id\":0, \"id\":" + std::to_string(_id) + ",\"timestamps\":" + timestamps + ",\"" + sensor_type + "\":{\"x\":[" + data[0] + "],\"y\":[" + data[1] + "],\"z\":[" + data[2] + "]}}";
-	 return jsonObj;
+
+    // JSON formatting: {"<S::name()>":{"<S::axis(0)>":[...], ...}}
+    std::string jsonObj = "{\"user_id\":" + std::to_string(_userId) +
+        ", \"id\":" + std::to_string(_id) +
+        ",\"timestamps\":" + std::to_string(_timestamp) +
+        ",\"kind\":\"" + _kindName() + "\"" +
+        ",\"profile\":" + std::to_string(_profile) +
+        ",\"sampling_period\":" + std::to_string(_storedPeriod) +
+        ",\"device_sampling_period\":" + std::to_string(_devicePeriod) +
+        ",\"" + S::name() + "\":{";
+    for (std::size_t c = 0; c < C; c++) {
+      if (c)
+        jsonObj += ",";
+      jsonObj += "\"";
+      jsonObj += S::axis(c);
+      jsonObj += "\":[";
+      for (int j = 0; j < numSample; j++) {
+        jsonObj += std::to_string(data[c][j]);
+        if (j < numSample-1)
+          jsonObj += ",";
+      }
+      jsonObj += "]";
+    }
+    jsonObj += "}}";
+    return jsonObj;
   }
 
-  std::vector<float> & operator[](std::size_t idx)
+  //
+  // Per-channel min/max/mean/rms instead of the samples:
+  // {..., "kind":"summary", "samples":n, "events":e,
+  //  "<S::name()>":{"<S::axis(0)>":{"min":..,"max":..,"mean":..,"rms":..}, ...}}
+  //
+  std::string formatSummaryJson() override
+  {
+    std::size_t numSample = _numSamples();
+
+    std::string jsonObj = "{\"user_id\":" + std::to_string(_userId) +
+        ", \"id\":" + std::to_string(_id) +
+        ",\"timestamps\":" + std::to_string(_timestamp) +
+        ",\"kind\":\"summary\"" +
+        ",\"profile\":" + std::to_string(_profile) +
+        ",\"sampling_period\":" + std::to_string(_storedPeriod) +
+        ",\"samples\":" + std::to_string(numSample) +
+        ",\"events\":" + std::to_string(_events) +
+        ",\"" + S::name() + "\":{";
+    for (std::size_t c = 0; c < C; c++) {
+      float lo = 0, hi = 0;
+      double sum = 0, sumSq = 0;
+      for (std::size_t j = 0; j < numSample; j++) {
+        float v = data[c][j];
+        if (j == 0 || v < lo)
+          lo = v;
+        if (j == 0 || v > hi)
+          hi = v;
+        sum += v;
+        sumSq += (double)v * v;
+      }
+      double mean = numSample ? sum / numSample : 0;
+      double rms = numSample ? std::sqrt(sumSq / numSample) : 0;
+      if (c)
+        jsonObj += ",";
+      jsonObj += "\"";
+      jsonObj += S::axis(c);
+      jsonObj += "\":{\"min\":" + std::to_string(lo) +
+          ",\"max\":" + std::to_string(hi) +
+          ",\"mean\":" + std::to_string(mean) +
+          ",\"rms\":" + std::to_string(rms) + "}";
+    }
+    jsonObj += "}}";
+    return jsonObj;
+  }
+
+  //
+  // The coarse levels of `_summary` instead of the samples, finer detail
+  // being left in the archive (see fetch.h):
+  // {..., "kind":"pyramid", "samples":n, "events":e,
+  //  "<S::name()>":{"10":[<cell>, ...], "60":[<cell>]}}
+  // with cells as written by `appendCellJson`.
+  //
+  std::string formatPyramidJson() override
+  {
+    _summary.finish(); // windows handed over early are still open
+
+    std::string jsonObj = "{\"user_id\":" + std::to_string(_userId) +
+        ", \"id\":" + std::to_string(_id) +
+        ",\"timestamps\":" + std::to_string(_timestamp) +
+        ",\"kind\":\"pyramid\"" +
+        ",\"profile\":" + std::to_string(_profile) +
+        ",\"sampling_period\":" + std::to_string(_storedPeriod) +
+        ",\"samples\":" + std::to_string(_numSamples()) +
+        ",\"events\":" + std::to_string(_events) +
+        ",\"" + S::name() + "\":{";
+    for (int k = LEVEL_10S; k < NUM_LEVELS; k++) {
+      if (k > LEVEL_10S)
+        jsonObj += ",";
+      jsonObj += "\"" + std::to_string(levelSpans[k] / 1000) + "\":[";
+      const auto& cells = _summary.cells[k];
+      for (std::size_t j = 0; j < cells.size(); j++) {
+        if (j)
+          jsonObj += ",";
+        appendCellJson<S>(jsonObj, cells[j]);
+      }
+      jsonObj += "]";
+    }
+    jsonObj += "}}";
+    return jsonObj;
+  }
+
+  float *operator[](std::size_t idx)
   {
     return data[idx];
   }
 
-  const std::vector<float>& operator[](std::size_t idx) const
+  const float *operator[](std::size_t idx) const
   {
     return data[idx];
   }
 
-  void tick(const std::vector<float>& readValue)
+  //
+  // `values` points at (at least) `C` channel values of one sensor event.
+  // Returns true if the event was kept as a stored-rate sample.
+  //
+  bool tick(const float *values)
   {
     if (_done)
-      return;
+      return false;
 
     _tick++;
-    if (_tick % (_samplingPeriod / _deviceSamplingPeriod)) {
-      return;
+    if (_tick % (_storedPeriod / _devicePeriod)) {
+      return false;
     }
+    return push(values);
+  }
+
+  bool tick(const std::vector<float>& readValue)
+  {
+    if (readValue.size() != C)
+      return false;
+    return tick(readValue.data());
+  }
+
+  // Append one stored-rate sample as is (no decimation)
+  bool push(const float *values)
+  {
+    if (_done)
+      return false;
+
     size_t idx = _nextIdx++;
-    if (readValue.size() != _numChannels())
-      return;
 
-    for (int i = 0; i < _numChannels(); i++) {
-      data[i][idx] = readValue[i];
+    for (std::size_t i = 0; i < C; i++) {
+      data[i][idx] = values[i];
     }
 
-    if (_nextIdx == (_duration() * 1000 / _samplingPeriod)) {
+    _summary.add(values, _timestamp * 1000 + (uint64_t)idx * _storedPeriod);
+
+    if (_nextIdx == _capacity) {
       _done = true;
+      _summary.finish();
     }
+    return true;
   }
 };
+
+#endif /* __DATA_H__ */
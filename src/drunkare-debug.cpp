@@ -1,41 +1,21 @@
 #include <string>
-#include <iostream>
-#include <iomanip>
-#include <fstream>
-#include <queue>
-#include <deque>
-// #include <thread>
-#include <pthread.h>
-#include <memory>
+#include <vector>
+#include <cstdio>
 
 // Tizen libraries
-#include <locations.h>
-#include <sensor.h>
 #include <privacy_privilege_manager.h>
 #include <efl_util.h>
 #include <service_app.h>
 #include <app_alarm.h>
 #include <app_control.h>
-#include <device/power.h>
+#include <sensor.h>
 #include <Ecore.h>
 #include <curl/curl.h>
 
 #include "drunkare-debug.h"
-#include "queue.h"
-#include "data.h"
-
-#define NUM_SENSORS 2
-#define NUM_CHANNELS 3
-#define NUM_CONTEXTS 4
-#define DURATION 60 // seconds
-#define CONTEXT_DURATION 60 * 60 * 24 // seconds
-#define MAX_MEASURE_ID (CONTEXT_DURATION / DURATION)
-#define ACCELEROMETER 0
-#define GYROSCOPE 1
-
-static location_service_state_e service_state;
-
-using TMeasure = Measure<NUM_CHANNELS, DURATION>;
+#include "ecore-loop.h"
+#include "tizen-platform.h"
+#include "collector.h"
 
 static std::vector<std::string> btnLabels = {"start", "stop"};
 static std::vector<std::pair<int, int>> btnOfs = {{50, 110}, {190, 110}};
@@ -46,37 +26,14 @@ struct appdata_s {
   Evas_Object *label;
   std::vector<Evas_Object *> startBtn;
   std::vector<Evas_Object *> stopBtn;
-  Evas_Object* lmCreateBtn;
-  Evas_Object* lmDestroyBtn;
-  std::string response; // TODO: delete this
-
-  // Extra app data
-  bool _isMeasuring;
-  int _numWrite;
-  int _context;
-  sensor_h sensors[NUM_SENSORS];
-  sensor_listener_h listners[NUM_SENSORS];
-  int _deviceSamplingRate = 10;
-  std::vector<int> _measureId;
-  std::vector<int> _doneMeasureId;
-  std::deque<std::unique_ptr<TMeasure>> tMeasures[NUM_SENSORS];
-  pthread_t fsWorker; // format and write to file system
-  Queue<TMeasure> queue;
-
-  std::string filepath;
-  std::string pathname;
-
-  location_manager_h location;
-  Ecore_Timer *timer;
-  int alarm_id;
-
-  bool location_available;
-  bool location_service_is_running;
-  double user_latitude;
-  double user_longitude;
-
-  appdata_s(): win(nullptr), location(nullptr), location_available(false),
-               location_service_is_running(false) {}
+
+  // The data path (see collector.h) on the Ecore main loop and the
+  // watch's sensors, GPS, battery and power lock
+  EcoreLoop loop;
+  TizenPlatform<AppSensors> platform;
+  Collector collector;
+
+  appdata_s(): win(nullptr), collector(loop, platform) {}
 };
 
 static void win_delete_request_cb(void *data, Evas_Object *obj,
@@ -93,274 +50,32 @@ win_back_cb(void *data, Evas_Object *obj, void *event_info)
 }
 
 /*
- * Location manager functions ================================
+ * Location updates ================================
  */
 
-void __position_updated_cb(double latitude, double longitude, double altitude,
-                           time_t timestamp, void *user_data)
+// `Collector::onPosition`: show the last fix (the collector uploads it)
+static void
+position_updated(appdata_s *ad, double latitude, double longitude)
 {
   char message[128];
-  int ret = 0;
-  appdata_s *ad = (appdata_s *) user_data;
-
-  ad->location_available = true;
-  ad->user_latitude = latitude;
-  ad->user_longitude = longitude;
 
-  sprintf(message, "(%f,%f)\n", ad->user_latitude, ad->user_longitude);
+  snprintf(message, sizeof(message), "(%f,%f)\n", latitude, longitude);
   elm_object_text_set(ad->label, message);
   evas_object_show(ad->label);
-
-  dlog_print(DLOG_DEBUG, LOG_TAG, "%d %d",
-             ad->_numWrite, ad->_deviceSamplingRate);
-
-  dlog_print(DLOG_DEBUG, LOG_TAG, "[%ld] lat[%f] lon[%f] alt[%f] (ret=%d)",
-             timestamp, latitude, longitude, altitude, ret);
-
-
-  /*
-   * Let's do CURL! =========================================
-   */
-  CURL* curl;
-  CURLcode res;
-  unsigned long long curl_timestamp = (unsigned long long)time(nullptr); // Hack!
-
-  std::ostringstream oss;
-  oss << "{\"timestamp\":" << curl_timestamp << ","
-      << "\"user_id\":0," /* dummy user_id */
-      << "\"latitude\":" << std::setprecision(8) << ad->user_latitude << ","
-      << "\"longitude\":" << std::setprecision(8) << ad->user_longitude << "}";
-  std::string jsonObj = oss.str();
-
-  // {url}:{port}/location
-  std::string url = "localhost:8080/data/gps";
-
-  curl_global_init(CURL_GLOBAL_ALL);
-  curl = curl_easy_init();
-
-  struct curl_slist *headers = NULL;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-  headers = curl_slist_append(headers, "charsets: utf-8");
-
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, jsonObj.c_str());
-
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    pthread_exit(NULL);
-
-    for (auto button : ad->startBtn) {
-      elm_object_disabled_set(button, EINA_FALSE);
-    }
-  }
-  /* end CURL... */
-
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
-  usleep(3000);
-
-  // sprintf(message, "<align=left>[%ld] lat[%f] lon[%f] alt[%f]
-  // (ret=%d)\n</align>", 		timestamp, latitude, longitude, altitude, ret);
-  // elm_entry_entry_set(ad->label, message);
-
-  // stop_location_service(ad);
-}
-
-static void
-__state_changed_cb(location_service_state_e state, void* user_data)
-{
-  double altitude;
-  double latitude;
-  double longitude;
-  double climb;
-  double direction;
-  double speed;
-  double horizontal;
-  double vertical;
-  location_accuracy_level_e level;
-  time_t timestamp;
-  int ret;
-
-  appdata_s *ad = (appdata_s *)user_data;
-
-  if (state == LOCATIONS_SERVICE_ENABLED) {
-    dlog_print(DLOG_INFO, LOG_TAG, "[+] LOCATIONS_SERVICE_ENABLED");
-    ret = location_manager_get_location(
-        ad->location, &altitude, &latitude, &longitude, &climb, &direction, &speed,
-        &level, &horizontal, &vertical, &timestamp);
-
-    ad->location_available = true;
-    ad->user_longitude = longitude;
-    ad->user_latitude = latitude;
-
-  } else {
-    dlog_print(DLOG_INFO, LOG_TAG, "[+] LOCATIONS_SERVICE_DISABLED");
-  }
 }
 
+// `Collector::onStopped`: measurement ended, from a button or by itself
 static void
-create_location_service(void *data)
+measurement_stopped(appdata_s *ad)
 {
-  appdata_s *ad = (appdata_s *)data;
-  location_manager_h manager;
-  int ret;
-
-  /* Create the location service to use all positioning source */
-  ret = location_manager_create(LOCATIONS_METHOD_HYBRID, &manager);
-  if (ret != LOCATIONS_ERROR_NONE) {
-    dlog_print(DLOG_INFO, LOG_TAG,
-               "[-] location_manager_create() failed. (%d)", ret);
-  } else {
-    ad->location = manager;
-    ret = location_manager_set_position_updated_cb(manager,
-                                                   __position_updated_cb,
-                                                   60 /* Period */,
-                                                   data /* Really? */);
-
-    if (ret != LOCATIONS_ERROR_NONE) {
-      dlog_print(DLOG_INFO, LOG_TAG,
-                 "[-] location_manager_set_position_updated_cb() failed. (%d)", ret);
-    }
-    ret = LOCATIONS_ERROR_NONE;
-
-    ret = location_manager_set_service_state_changed_cb(manager,
-                                                        __state_changed_cb,
-                                                        data /* Really? */);
-
-    if (ret != LOCATIONS_ERROR_NONE) {
-      dlog_print(DLOG_INFO, LOG_TAG,
-                 "[-] location_manager_set_state_changed_cb() failed. (%d)", ret);
-    }
-  }
-}
-
-static void
-destroy_location_service(void *data)
-{
-  appdata_s *ad = (appdata_s *)data;
-  int ret;
-
-  ret = location_manager_destroy(ad->location);
-  if (ret != LOCATIONS_ERROR_NONE)
-    dlog_print(DLOG_INFO, LOG_TAG,
-               "[-] location_manager_destroy() failed. (%d)", ret);
-  else
-    ad->location = nullptr;
-}
-
-/* Create an app control for the alarm */
-// static bool
-// _initialize_alarm(void *data)
-// {
-//   appdata_s *ad = (appdata_s *) data;
-// 
-//   int ret;
-//   int DELAY = 120;
-//   int alarm_id;
-// 
-//   app_control_h app_control = nullptr;
-//   ret = app_control_create(&app_control);
-//   ret = app_control_set_operation(app_control, APP_CONTROL_OPERATION_DEFAULT);
-// 
-//   /* Set app_id as the name of the application */
-//   ret = app_control_set_app_id(app_control, "com.drunkare.debug");
-// 
-//   /* Set the key ("location") and value ("stop") of a bundle */
-//   ret = app_control_add_extra_data(app_control, "location", "stop");
-// 
-//   /* In order to be called after DELAY */
-//   ret = alarm_schedule_once_after_delay(app_control, DELAY, &alarm_id);
-//   if (ret != ALARM_ERROR_NONE) {
-//     char *err_msg = get_error_message(ret);
-//     dlog_print(DLOG_ERROR, LOG_TAG,
-//                "alarm_schedule_once_after_delay() failed.(%d)", ret);
-//     dlog_print(DLOG_INFO, LOG_TAG, "%s", err_msg);
-// 
-//     return false;
-//   }
-// 
-//   ad->alarm_id = alarm_id;
-// 
-//   ret = app_control_destroy(app_control);
-//   if (ret != APP_CONTROL_ERROR_NONE)
-//     dlog_print(DLOG_ERROR, LOG_TAG, "app_control_destroy() failed.(%d)", ret);
-//   else
-//     dlog_print(DLOG_DEBUG, LOG_TAG, "Set the triggered time with alarm_id: %d",
-//                ad->alarm_id);
-// 
-//   return true;
-// }
-
-static void
-start_location_service(void *data)
-{
-  dlog_print(DLOG_INFO, LOG_TAG, "[+] start_location_service()");
-
-  appdata_s *ad = (appdata_s *)data;
-  int ret = 0;
-
-  if (ad->location_service_is_running) {
-    /* Location servuce is always running */
-    dlog_print(DLOG_WARN, LOG_TAG,
-               "[-] start_location_service() is invoked while service is already running");
-    return;
-  }
-
-  ret = location_manager_start(ad->location);
-  if (ad->location) {
-    if (ret != LOCATIONS_ERROR_NONE) {
-      dlog_print(DLOG_ERROR, LOG_TAG, "location_manager_start() failed: %d",
-                 ret);
-    } else {
-      dlog_print(DLOG_DEBUG, LOG_TAG, "location service was started");
-      ad->location_service_is_running = true;
-    }
-
-    /* Create a app control for the alarm */
-    // ret = _initialize_alarm(ad);
-  } else {
-    dlog_print(DLOG_ERROR, LOG_TAG, "[-] ad->location == nullptr");
-    create_location_service(data);
-  }
-}
-
-static void
-stop_location_service(void *data)
-{
-  dlog_print(DLOG_INFO, LOG_TAG, "[+] stop_location_service()");
-
-  appdata_s *ad = (appdata_s *)data;
-  int ret = 0;
-
-  if (!ad->location_service_is_running) {
-    /* Location servuce is NOT running */
-    dlog_print(DLOG_WARN, LOG_TAG,
-               "[-] stop_location_service() is invoked while service is not running");
-    return;
+  for (auto button : ad->startBtn) {
+    elm_object_disabled_set(button, EINA_FALSE);
   }
 
-  if (ad->location) {
-    ret = location_manager_stop(ad->location);
-    if (ret != LOCATIONS_ERROR_NONE) {
-      dlog_print(DLOG_ERROR, LOG_TAG, "location_manager_stop() failed: %d",
-                 ret);
-    } else {
-      dlog_print(DLOG_DEBUG, LOG_TAG, "location service was stopped.");
-      ad->location_service_is_running = false;
-    }
-
-    ad->location_available = false;
-
-    // if (ad->alarm_id) {
-    //   alarm_cancel(ad->alarm_id);
-    //   ad->alarm_id = 0;
-    // }
-  }
+  // Set screen to default mode
+  // efl_util_set_window_screen_mode(ad->win, EFL_UTIL_SCREEN_MODE_DEFAULT);
 }
 
-
 /*
  * Privacy-related Permissions ================================
  */
@@ -382,13 +97,8 @@ app_request_response_cb(ppm_call_cause_e cause, ppm_request_result_e result,
     dlog_print(DLOG_INFO, LOG_TAG,
                "[+] PRIVACY_PRIVILEGE_MANAGER_REQUEST_RESULT_ALLOW_FOREVER");
 
-    if (!ad->location)
-      /* Create location manager once */
-      create_location_service((void *)ad);
-
-    if (ad->location) {
-      start_location_service((void *)ad);
-    }
+    /* The location manager is created on first start */
+    ad->collector.startLocation();
     break;
   case PRIVACY_PRIVILEGE_MANAGER_REQUEST_RESULT_DENY_FOREVER:
     /* Show a message and terminate the application */
@@ -430,192 +140,6 @@ app_check_and_request_permission(void *user_data)
 }
 
 
-//
-// Main function for `netWorker`.
-//   1. Dequeue a `Measure` from `ad->queue`
-//   2. Format POST fields
-//   3. Send POST request to <hostname:port>
-//   4. Repeat
-//
-static void* netWorkerJob(void* data) {
-  appdata_s *ad = (appdata_s *)data;
-  CURL *curl;
-  CURLcode res;
-
-  while (true) {
-    auto tMeasure = ad->queue.dequeue();
-
-    if (!tMeasure)
-      break;
-
-    std::string jsonObj = tMeasure->formatJson();
-
-    // {url}:{port}/data
-    std::string url = "localhost:8080/data/";
-
-    /* Curl POST */
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    headers = curl_slist_append(headers, "charsets: utf-8");
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, jsonObj.c_str());
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-    	pthread_exit(NULL);
-
-        for (auto button : ad->startBtn) {
-          elm_object_disabled_set(button, EINA_FALSE);
-        }
-    }
-
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    usleep(3000);
-  }
-
-  return nullptr;
-}
-
-static void startMeasurement(appdata_s *ad);
-static void stopMeasurement(appdata_s *ad);
-
-void sensorCb(sensor_h sensor, sensor_event_s *event, void *user_data)
-{
-  appdata_s *ad = (appdata_s *)user_data;
-  int sensor_type;
-  sensor_type_e type;
-  sensor_get_type(sensor, &type);
-  std::vector<float> values;
-
-  switch (type) {
-  case SENSOR_ACCELEROMETER:
-    sensor_type = ACCELEROMETER;
-    break;
-  case SENSOR_GYROSCOPE:
-    sensor_type = GYROSCOPE;
-    break;
-  default:
-    return;
-  }
-
-  // Save temporary value array
-  for (int i = 0; i < NUM_CHANNELS; i++) {
-    values.push_back(event->values[i]);
-  }
-
-  // Check tMeasures deque
-  if (ad->tMeasures[sensor_type].empty()) {
-    unsigned long long timestamp = (unsigned long long)time(nullptr);
-    ad->tMeasures[sensor_type].push_back(
-        std::make_unique<TMeasure>(ad->_measureId[sensor_type]++,
-                                   sensor_type, ad->_context, timestamp));
-  }
-
-  // Tick (store values in Measure.data every periods)
-  ad->tMeasures[sensor_type].front()->tick(values);
-
-  // Check Measure->_done and enqueue
-  if (ad->tMeasures[sensor_type].front()->_done) {
-    ad->_doneMeasureId[sensor_type] = ad->tMeasures[sensor_type].front()->_id;
-
-    ad->queue.enqueue(std::move(ad->tMeasures[sensor_type].front()));
-    ad->tMeasures[sensor_type].pop_front();
-
-    // Check termination condition
-    if (ad->_doneMeasureId[sensor_type] >= MAX_MEASURE_ID) {
-      bool allFinished = true;
-
-      for (auto doneId : ad->_doneMeasureId) {
-        allFinished &= (doneId >= MAX_MEASURE_ID);
-      }
-
-      if (allFinished) {
-        stopMeasurement(ad);
-        return;
-      }
-    }
-  }
-}
-
-static void startMeasurement(appdata_s *ad)
-{
-  dlog_print(DLOG_INFO, LOG_TAG, "[+] start_location_service()");
-
-  /* NOTE that is is very less likely to be here, since we disable
-     button while measuring */
-  if (ad->_isMeasuring) {
-    /* sensor servuce is already running */
-    dlog_print(DLOG_WARN, LOG_TAG,
-               "[-] startMeasurement() is invoked while sensor service is already running");
-    return;
-  }
-
-
-  ad->queue.clear();
-
-  // See https://stackoverflow.com/questions/49752776
-  device_power_request_lock(POWER_LOCK_CPU, 0);
-
-  // Create thread here
-  if (pthread_create(&ad->fsWorker, nullptr, netWorkerJob, (void *)ad) < 0) {
-    // dlog_print(DLOG_ERROR, "btnClickedCb", "[-] pthread_create()");
-    return;
-  };
-
-  // See https://stackoverflow.com/questions/49752776
-  for (int i = 0; i < NUM_SENSORS; i++) {
-    sensor_listener_set_option(ad->listners[i], SENSOR_OPTION_ALWAYS_ON);
-    sensor_listener_set_attribute_int(ad->listners[i], SENSOR_ATTRIBUTE_PAUSE_POLICY, SENSOR_PAUSE_NONE);
-    sensor_listener_set_event_cb(ad->listners[i], ad->_deviceSamplingRate,
-                                 sensorCb, ad);
-    sensor_listener_start(ad->listners[i]);
-  }
-  ad->_isMeasuring = true;
-}
-
-static void stopMeasurement(appdata_s *ad)
-{
-  dlog_print(DLOG_INFO, LOG_TAG, "[+] stop_location_service()");
-
-  if (!ad->_isMeasuring) {
-    /* sensor servuce is NOT running */
-    dlog_print(DLOG_WARN, LOG_TAG,
-               "[-] stopMeasurement() is invoked while sensor service is not running");
-    return;
-  }
-
-  ad->_isMeasuring = false;
-
-  device_power_release_lock(POWER_LOCK_CPU);
-
-  for (int i = 0; i < NUM_SENSORS; i++) {
-    sensor_listener_stop(ad->listners[i]);
-  }
-
-  ad->queue.forceDone();
-  pthread_join(ad->fsWorker, nullptr);
-
-  for (int i = 0; i < ad->_measureId.size(); i++) {
-    ad->_measureId[i] = 0;
-    ad->_doneMeasureId[i] = -1;
-    // dlog_print(DLOG_DEBUG, "stopMeasurement", "[+] ad->_measureId[%d] = %d", i,
-    //            ad->_measureId[i]);
-  }
-
-  for (auto button : ad->startBtn) {
-    elm_object_disabled_set(button, EINA_FALSE);
-  }
-
-  // Set screen to default mode
-  // efl_util_set_window_screen_mode(ad->win, EFL_UTIL_SCREEN_MODE_DEFAULT);
-}
 
 static void startBtnClickedCb(void *data, Evas_Object *obj, void *event_info)
 {
@@ -624,25 +148,24 @@ static void startBtnClickedCb(void *data, Evas_Object *obj, void *event_info)
   // 1. Set screen always on (This is due to hardware limitation)
   // efl_util_set_window_screen_mode(ad->win, EFL_UTIL_SCREEN_MODE_ALWAYS_ON);
 
-  ad->_context = 0;
-
-  if (!ad->_isMeasuring) {
+  if (!ad->collector.measuring()) {
     for (auto button : ad->startBtn) {
       elm_object_disabled_set(button, EINA_TRUE);
     }
 
-    startMeasurement(ad);
+    ad->collector.start(0);
   }
 
   /* Used to restart location service stopped by user */
-  start_location_service(data);
+  ad->collector.startLocation();
 }
 
 static void stopBtnClickedCb(void *data, Evas_Object *obj, void *event_info)
 {
-  stopMeasurement((appdata_s*)data);
+  appdata_s* ad = (appdata_s *)data;
 
-  stop_location_service(data);
+  ad->collector.stop();
+  ad->collector.stopLocation();
 }
 
 static void
@@ -703,21 +226,7 @@ create_base_gui(appdata_s *ad)
 	elm_object_content_set(ad->conform, ad->label);
 
         /* Custom initializations are here! */
-        ad->response = ""; // TODO: delete this
-        ad->_isMeasuring = false;
         init_buttons(ad, startBtnClickedCb, stopBtnClickedCb);
-        sensor_get_default_sensor(SENSOR_ACCELEROMETER, &ad->sensors[ACCELEROMETER]);
-        sensor_get_default_sensor(SENSOR_GYROSCOPE, &ad->sensors[GYROSCOPE]);
-        for (int i = 0; i < NUM_SENSORS; i++) {
-          sensor_create_listener(ad->sensors[i], &ad->listners[i]);
-
-          // Initialize per-sensor measure IDs
-          ad->_measureId.push_back(0);
-          ad->_doneMeasureId.push_back(-1);
-        }
-
-        ad->filepath = std::string(app_get_data_path());
-        ad->pathname = ad->filepath + std::string("data.csv");
 
         /* Show window after base gui is set up */
 	evas_object_show(ad->win);
@@ -732,16 +241,18 @@ app_create(void *data)
      If this function returns false, the application is terminated */
   appdata_s *ad = (appdata_s *)data;
 
+  curl_global_init(CURL_GLOBAL_ALL);
+  ad->collector.onStopped = [ad]() { measurement_stopped(ad); };
+  ad->collector.onPosition = [ad](double latitude, double longitude) {
+    position_updated(ad, latitude, longitude);
+  };
+  ad->collector.create();
+
   create_base_gui(ad);
 
   /* Ask for users to agree on location access */
   app_check_and_request_permission(data);
 
-  // create_location_service(ad);
-
-  // if (ad->location)
-  //   start_location_service(ad);
-
   return true;
 }
 
@@ -757,8 +268,7 @@ app_control(app_control_h app_control, void *data)
   // if (app_control_get_extra_data(app_control, "location", &value) ==
   //     APP_CONTROL_ERROR_NONE) {
   //   if (!strcmp(value, "stop")) {
-  //     if (ad->location)
-  //       stop_location_service(ad);
+  //     ad->collector.stopLocation();
   //   }
   //   free(value);
   // }
@@ -770,7 +280,7 @@ app_pause(void *data)
   /* Take necessary actions when application becomes invisible. */
   appdata_s *ad = (appdata_s *)data;
 
-  // stop_location_service(ad);
+  // ad->collector.stopLocation();
 }
 
 static void
@@ -781,7 +291,7 @@ app_resume(void *data)
 
   app_check_and_request_permission(data);
 
-  start_location_service(ad);
+  ad->collector.startLocation();
 }
 
 static void
@@ -790,10 +300,8 @@ app_terminate(void *data)
   /* Release all resources. */
   appdata_s *ad = (appdata_s *)data;
 
-  stop_location_service(data);
-
-  if (ad->location)
-    destroy_location_service(ad);
+  ad->collector.destroy();
+  curl_global_cleanup();
 }
 
 static void
@@ -824,12 +332,28 @@ static void
 ui_app_low_battery(app_event_info_h event_info, void *user_data)
 {
 	/*APP_EVENT_LOW_BATTERY*/
+  appdata_s *ad = (appdata_s *)user_data;
+  app_event_low_battery_status_e status;
+
+  if (app_event_get_low_battery_status(event_info, &status) != APP_ERROR_NONE)
+    return;
+  dlog_print(DLOG_WARN, LOG_TAG, "[-] low battery (%d)", status);
+  ad->collector.lowBattery();
 }
 
 static void
 ui_app_low_memory(app_event_info_h event_info, void *user_data)
 {
 	/*APP_EVENT_LOW_MEMORY*/
+  appdata_s *ad = (appdata_s *)user_data;
+  app_event_low_memory_status_e status;
+
+  if (app_event_get_low_memory_status(event_info, &status) != APP_ERROR_NONE)
+    return;
+
+  // Soft or hard warning: spill queued windows to disk until it is over
+  dlog_print(DLOG_WARN, LOG_TAG, "[-] low memory (%d)", status);
+  ad->collector.lowMemory(status != APP_EVENT_LOW_MEMORY_NORMAL);
 }
 
 int
@@ -841,11 +365,15 @@ main(int argc, char *argv[])
 	ui_app_lifecycle_callback_s event_callback = {0,};
 	app_event_handler_h handlers[5] = {NULL, };
 
-        bool supported[NUM_SENSORS];
-	sensor_is_supported(SENSOR_ACCELEROMETER, &supported[ACCELEROMETER]);
-	sensor_is_supported(SENSOR_GYROSCOPE, &supported[GYROSCOPE]);
-	if (!supported[ACCELEROMETER] || !supported[GYROSCOPE]) {
-		/* Accelerometer is not supported on the current device */
+        bool allSupported = true;
+        forEachSensor<AppSensors>([&allSupported](auto i) {
+          using S = SensorAt<decltype(i)::value, AppSensors>;
+          bool supported = false;
+          sensor_is_supported(S::native, &supported);
+          allSupported &= supported;
+        });
+	if (!allSupported) {
+		/* One of the sensors is not supported on the current device */
 		return 1;
 	}
 
@@ -0,0 +1,111 @@
+#ifndef __ECORE_LOOP_H__
+#define __ECORE_LOOP_H__
+
+#include <Ecore.h>
+
+#include "loop.h"
+
+//
+// `Loop` on top of the Ecore main loop: fds become Ecore fd handlers,
+// timers become `Ecore_Timer`s and `post` goes through
+// `ecore_main_loop_thread_safe_call_async`.
+//
+struct EcoreLoop : Loop {
+  void *watchFd(int fd, int events, FdCb cb, void *data) override
+  {
+    Watch *w = new Watch{nullptr, cb, data};
+    w->handler = ecore_main_fd_handler_add(fd, toEcore(events), fdCb, w,
+                                           nullptr, nullptr);
+    if (!w->handler) {
+      delete w;
+      return nullptr;
+    }
+    return w;
+  }
+
+  void modifyFd(void *handle, int events) override
+  {
+    ecore_main_fd_handler_active_set(((Watch *)handle)->handler,
+                                     toEcore(events));
+  }
+
+  void unwatchFd(void *handle) override
+  {
+    // Ecore defers freeing a handler deleted from inside its own callback,
+    // and `fdCb` does not touch `w` after dispatching.
+    Watch *w = (Watch *)handle;
+    ecore_main_fd_handler_del(w->handler);
+    delete w;
+  }
+
+  void *addTimer(double seconds, TimerCb cb, void *data) override
+  {
+    Timer *t = new Timer{nullptr, cb, data};
+    t->timer = ecore_timer_add(seconds, timerCb, t);
+    if (!t->timer) {
+      delete t;
+      return nullptr;
+    }
+    return t;
+  }
+
+  void delTimer(void *handle) override
+  {
+    Timer *t = (Timer *)handle;
+    ecore_timer_del(t->timer);
+    delete t;
+  }
+
+  void post(PostCb cb, void *data) override
+  {
+    ecore_main_loop_thread_safe_call_async(cb, data);
+  }
+
+private:
+  struct Watch {
+    Ecore_Fd_Handler *handler;
+    FdCb cb;
+    void *data;
+  };
+
+  struct Timer {
+    Ecore_Timer *timer;
+    TimerCb cb;
+    void *data;
+  };
+
+  static Ecore_Fd_Handler_Flags toEcore(int events)
+  {
+    int flags = 0;
+    if (events & READ)
+      flags |= ECORE_FD_READ;
+    if (events & WRITE)
+      flags |= ECORE_FD_WRITE;
+    return (Ecore_Fd_Handler_Flags)flags;
+  }
+
+  static Eina_Bool fdCb(void *data, Ecore_Fd_Handler *handler)
+  {
+    Watch *w = (Watch *)data;
+    int fd = ecore_main_fd_handler_fd_get(handler);
+    int events = 0;
+    if (ecore_main_fd_handler_active_get(handler,
+                                         (Ecore_Fd_Handler_Flags)(ECORE_FD_READ | ECORE_FD_ERROR)))
+      events |= READ;
+    if (ecore_main_fd_handler_active_get(handler, ECORE_FD_WRITE))
+      events |= WRITE;
+    w->cb(w->data, fd, events);
+    return ECORE_CALLBACK_RENEW;
+  }
+
+  static Eina_Bool timerCb(void *data)
+  {
+    Timer *t = (Timer *)data;
+    if (t->cb(t->data))
+      return ECORE_CALLBACK_RENEW;
+    delete t;
+    return ECORE_CALLBACK_CANCEL;
+  }
+};
+
+#endif /* __ECORE_LOOP_H__ */
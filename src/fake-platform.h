@@ -0,0 +1,246 @@
+#ifndef __FAKE_PLATFORM_H__
+#define __FAKE_PLATFORM_H__
+
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include "platform.h"
+#include "sensors.h"
+#include "loop.h"
+
+//
+// Simulated `Platform` for host builds, driven by timers of a `Loop`.
+//
+// Each sensor of `Sensors` produces `speedup` samples per device period:
+// a slow wobble with noise, plus a burst of strong motion for
+// `burstSeconds` every `burstPeriod` seconds of simulated time (0: never),
+// strong enough to fire the event triggers. `wobble` scales the motion
+// and noise outside bursts (around 0.02 and below, windows are idle, see
+// idle.h). Gyroscopes get deg/s scale, everything else m/s^2. Position
+// fixes random-walk around (`latitude`, `longitude`); the battery starts
+// at `percent` and drains by `drainPerHour` percent per hour of wall time
+// unless `charging`.
+//
+// The public knobs are read when sensors, location and battery watching
+// start.
+//
+template <typename Sensors>
+struct FakePlatform : Platform {
+  int speedup = 1;
+  double burstPeriod = 120; // s
+  double burstSeconds = 2;  // s
+  float wobble = 1;
+  double latitude = 37.4598;
+  double longitude = 126.9519;
+  int percent = 100;
+  bool charging = false;
+  double drainPerHour = 0;
+  std::string path = "/tmp/";
+
+  // What the core asked for, for reports
+  uint64_t samples[Sensors::size] = {};
+  uint64_t fixes = 0;
+  uint64_t methodSwitches = 0;
+  int locationMethod = LOCATION_HYBRID;
+  int locationPeriod = 0; // s; 0 while stopped
+  uint64_t cpuLocks = 0;
+  bool cpuLocked = false;
+
+  explicit FakePlatform(Loop& loop)
+      : _loop(loop), _ticking(nullptr), _locationTimer(nullptr),
+        _locationCb(nullptr), _locationData(nullptr), _batteryTimer(nullptr),
+        _batteryCb(nullptr), _batteryData(nullptr)
+  {
+    forEachSensor<Sensors>([this](auto i) {
+      using S = SensorAt<decltype(i)::value, Sensors>;
+      FakeSensor& s = _sensors[i];
+      s.self = this;
+      s.index = i;
+      s.channels = S::channels;
+      s.scale = S::native == SENSOR_GYROSCOPE ? 100.f : 1.f;
+      s.periodMs = S::devicePeriod;
+      s.cb = nullptr;
+      s.data = nullptr;
+      s.timer = nullptr;
+      s.n = 0;
+    });
+  }
+
+  ~FakePlatform()
+  {
+    for (std::size_t i = 0; i < Sensors::size; i++)
+      stopSensor(i);
+    stopLocation();
+    unwatchBattery();
+  }
+
+  FakePlatform(const FakePlatform&) = delete;
+  FakePlatform& operator=(const FakePlatform&) = delete;
+
+  bool startSensor(std::size_t sensor, int periodMs, SampleCb cb,
+                   void *data) override
+  {
+    FakeSensor& s = _sensors[sensor];
+    stopSensor(sensor);
+    s.cb = cb;
+    s.data = data;
+    s.periodMs = periodMs;
+    s.timer = _loop.addTimer(periodMs / 1000.0, sampleTimerCb, &s);
+    return s.timer != nullptr;
+  }
+
+  void setSensorPeriod(std::size_t sensor, int periodMs) override
+  {
+    FakeSensor& s = _sensors[sensor];
+    if (s.timer)
+      startSensor(sensor, periodMs, s.cb, s.data);
+    else
+      s.periodMs = periodMs;
+  }
+
+  void stopSensor(std::size_t sensor) override
+  {
+    FakeSensor& s = _sensors[sensor];
+    if (!s.timer)
+      return;
+    // A timer can't be deleted from its own callback; it ends itself there
+    if (_ticking != &s)
+      _loop.delTimer(s.timer);
+    s.timer = nullptr;
+  }
+
+  void setCpuLock(bool lock) override
+  {
+    if (lock && !cpuLocked)
+      cpuLocks++;
+    cpuLocked = lock;
+  }
+
+  bool startLocation(int periodS, int method, LocationCb cb,
+                     void *data) override
+  {
+    stopLocation();
+    if (method != locationMethod)
+      methodSwitches++;
+    locationMethod = method;
+    locationPeriod = periodS;
+    _locationCb = cb;
+    _locationData = data;
+    _locationTimer = _loop.addTimer(periodS, locationTimerCb, this);
+    return _locationTimer != nullptr;
+  }
+
+  void stopLocation() override
+  {
+    if (_locationTimer)
+      _loop.delTimer(_locationTimer);
+    _locationTimer = nullptr;
+    locationPeriod = 0;
+  }
+
+  int batteryPercent() override { return percent; }
+  bool batteryCharging() override { return charging; }
+
+  void watchBattery(BatteryCb cb, void *data) override
+  {
+    unwatchBattery();
+    _batteryCb = cb;
+    _batteryData = data;
+    if (drainPerHour > 0)
+      _batteryTimer = _loop.addTimer(3600 / drainPerHour, batteryTimerCb, this);
+  }
+
+  void unwatchBattery() override
+  {
+    if (_batteryTimer)
+      _loop.delTimer(_batteryTimer);
+    _batteryTimer = nullptr;
+    _batteryCb = nullptr;
+  }
+
+  std::string dataPath() override { return path; }
+
+private:
+  struct FakeSensor {
+    FakePlatform *self;
+    std::size_t index;
+    std::size_t channels;
+    float scale;
+    int periodMs;
+    SampleCb cb;
+    void *data;
+    void *timer;
+    uint64_t n; // samples produced
+  };
+
+  void generate(FakeSensor& s, float *v)
+  {
+    double t = s.n * s.periodMs / 1000.0;
+    bool burst = burstPeriod > 0 && std::fmod(t, burstPeriod) < burstSeconds;
+    float amplitude = (burst ? 10.f : 0.2f * wobble) * s.scale;
+    float noise = (burst ? 0.01f : 0.01f * wobble) * s.scale;
+    float freq = burst ? 3.f : 0.5f; // Hz
+    for (std::size_t c = 0; c < s.channels; c++) {
+      v[c] = amplitude * (float)std::sin(2 * M_PI * freq * t + c) +
+             noise * (float)(rand() % 100 - 50);
+    }
+    s.n++;
+  }
+
+  static bool sampleTimerCb(void *data)
+  {
+    FakeSensor *s = (FakeSensor *)data;
+    FakePlatform *self = s->self;
+    void *timer = s->timer;
+    float v[16];
+
+    self->_ticking = s;
+    for (int k = 0; k < self->speedup && s->timer == timer; k++) {
+      self->generate(*s, v);
+      self->samples[s->index]++;
+      s->cb(v, s->data);
+    }
+    self->_ticking = nullptr;
+    // Stopped or restarted with another period from the callback
+    return s->timer == timer;
+  }
+
+  static bool locationTimerCb(void *data)
+  {
+    FakePlatform *self = (FakePlatform *)data;
+    self->latitude += 1e-5 * (rand() % 21 - 10);
+    self->longitude += 1e-5 * (rand() % 21 - 10);
+    self->fixes++;
+    self->_locationCb(self->latitude, self->longitude, 40.0, time(nullptr),
+                      self->_locationData);
+    return true;
+  }
+
+  static bool batteryTimerCb(void *data)
+  {
+    FakePlatform *self = (FakePlatform *)data;
+    if (self->charging || self->percent == 0)
+      return true;
+    self->percent--;
+    if (self->_batteryCb)
+      self->_batteryCb(self->percent, self->charging, self->_batteryData);
+    return true;
+  }
+
+  Loop& _loop;
+  FakeSensor _sensors[Sensors::size];
+  FakeSensor *_ticking; // sensor whose timer is running its callback
+
+  void *_locationTimer;
+  LocationCb _locationCb;
+  void *_locationData;
+
+  void *_batteryTimer;
+  BatteryCb _batteryCb;
+  void *_batteryData;
+};
+
+#endif /* __FAKE_PLATFORM_H__ */
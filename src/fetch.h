@@ -0,0 +1,391 @@
+#ifndef __FETCH_H__
+#define __FETCH_H__
+
+#include <string>
+#include <set>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <dlog.h>
+
+#include "loop.h"
+#include "archive.h"
+#include "pyramid.h"
+#include "sensors.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "drunkare-debug"
+#endif
+
+//
+// Local HTTP endpoint serving detail out of the on-device archive, so
+// uploads can stay coarse (see pyramid.h) and the server pulls raw data
+// or finer summaries only for the spans it needs:
+//
+//   GET /raw?sensor=S&from=T0&to=T1[&format=csv][&since=T]
+//       archived windows of sensor S (its index in `Sensors`) overlapping
+//       [T0, T1] (s), as back-to-back `Archive` records (the binary upload
+//       format) or as CSV rows like `Archive::exportCsv`
+//   GET /summary?sensor=S&level=L&from=T0&to=T1[&since=T]
+//       cells of level L (`LEVEL_1S`, `LEVEL_10S`, `LEVEL_60S`) starting in
+//       [T0, T1], rebuilt from the archived samples with the same
+//       alignment as uploaded ones (an idle run, see idle.h, is a single
+//       cell at its start):
+//       {"sensor":"<S::name()>","span":<ms>,"cells":[<cell>, ...]}
+//
+// A day of raw data is tens of MB, so a response stops after about
+// `kMaxBody` bytes, at the first new second past that, with
+// `X-Next-Since: <T>`: the same request with `since=T` (only records
+// starting at T or later) returns the rest. That bounds both the memory
+// a response holds and how long the archive stays locked while it is
+// built.
+//
+// One request per connection, answered and closed; beyond `kMaxConns`
+// connections new ones are closed right away. Everything runs on
+// `loop`, which is also where `Collector` archives windows. Listens on
+// `host` only: on the watch the default, loopback, is reached through
+// `sdb forward`.
+//
+template <typename Sensors>
+struct FetchServer {
+  static const std::size_t kMaxRequest = 8192;     // bytes of request head
+  static const std::size_t kMaxBody = 256 * 1024;  // bytes per response
+  static const std::size_t kMaxConns = 4;
+
+  // `windowSeconds`: longest span of an archived record (window or idle
+  // run), to find records begun before a range that reach into it
+  FetchServer(Loop& loop, Archive& archive, int windowSeconds)
+      : _loop(loop), _archive(archive), _windowSeconds(windowSeconds),
+        _fd(-1), _watch(nullptr) {}
+
+  ~FetchServer() { close(); }
+
+  FetchServer(const FetchServer&) = delete;
+  FetchServer& operator=(const FetchServer&) = delete;
+
+  bool open(const char *host, int port)
+  {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+      return false;
+
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+      return false;
+    int one = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(_fd, 16) < 0) {
+      ::close(_fd);
+      _fd = -1;
+      return false;
+    }
+    _watch = _loop.watchFd(_fd, Loop::READ, acceptCb, this);
+    dlog_print(DLOG_INFO, LOG_TAG, "[+] fetch server on %s:%d", host, port);
+    return true;
+  }
+
+  void close()
+  {
+    while (!_conns.empty())
+      closeConn(*_conns.begin());
+    if (_fd < 0)
+      return;
+    _loop.unwatchFd(_watch);
+    ::close(_fd);
+    _fd = -1;
+  }
+
+  uint64_t requests = 0;
+  uint64_t bytesOut = 0;
+
+private:
+  struct Conn {
+    FetchServer *self;
+    int fd;
+    void *watch;
+    std::string in;
+    std::string out;
+    bool answered;
+  };
+
+  static void acceptCb(void *data, int fd, int)
+  {
+    FetchServer *self = (FetchServer *)data;
+    while (true) {
+      int cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (cfd < 0)
+        return;
+      if (self->_conns.size() >= kMaxConns) {
+        ::close(cfd);
+        continue;
+      }
+      Conn *c = new Conn{self, cfd, nullptr, std::string(), std::string(),
+                         false};
+      c->watch = self->_loop.watchFd(cfd, Loop::READ, connCb, c);
+      self->_conns.insert(c);
+    }
+  }
+
+  void closeConn(Conn *c)
+  {
+    _loop.unwatchFd(c->watch);
+    ::close(c->fd);
+    _conns.erase(c);
+    delete c;
+  }
+
+  static void connCb(void *data, int fd, int events)
+  {
+    Conn *c = (Conn *)data;
+    FetchServer *self = c->self;
+
+    if ((events & Loop::READ) && !c->answered) {
+      char buf[4096];
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        self->closeConn(c);
+        return;
+      }
+      if (n > 0)
+        c->in.append(buf, n);
+      std::size_t end = c->in.find("\r\n\r\n");
+      if (end != std::string::npos)
+        self->answer(c, c->in.substr(0, c->in.find("\r\n")));
+      else if (c->in.size() > kMaxRequest)
+        self->respond(c, 400, "text/plain", "request too large\n");
+    }
+
+    if (!c->out.empty()) {
+      ssize_t n = write(fd, c->out.data(), c->out.size());
+      if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        self->closeConn(c);
+        return;
+      }
+      if (n > 0) {
+        c->out.erase(0, n);
+        self->bytesOut += n;
+      }
+    }
+    if (c->answered && c->out.empty()) {
+      self->closeConn(c);
+      return;
+    }
+    self->_loop.modifyFd(c->watch, c->answered ? Loop::WRITE : Loop::READ);
+  }
+
+  // `next`: if non-zero, the `since` of the rest of a cut-off response
+  void respond(Conn *c, int status, const char *type, const std::string& body,
+               uint64_t next = 0)
+  {
+    const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request" :
+                         status == 404 ? "Not Found" : "Method Not Allowed";
+    char head[320];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n",
+                     status, reason, type, body.size());
+    if (next)
+      snprintf(head + n, sizeof(head) - n, "X-Next-Since: %llu\r\n",
+               (unsigned long long)next);
+    c->out = head;
+    c->out += "\r\n";
+    c->out += body;
+    c->answered = true;
+  }
+
+  // Value of `key` in a query string "a=1&b=2"
+  static std::string queryParam(const std::string& query, const char *key)
+  {
+    std::string k = std::string(key) + "=";
+    std::size_t pos = 0;
+    while (pos < query.size()) {
+      std::size_t end = query.find('&', pos);
+      if (end == std::string::npos)
+        end = query.size();
+      if (query.compare(pos, k.size(), k) == 0)
+        return query.substr(pos + k.size(), end - pos - k.size());
+      pos = end + 1;
+    }
+    return "";
+  }
+
+  static bool numberParam(const std::string& query, const char *key,
+                          uint64_t& value)
+  {
+    std::string s = queryParam(query, key);
+    char *end;
+    value = strtoull(s.c_str(), &end, 10);
+    return !s.empty() && *end == '\0';
+  }
+
+  // `line` is the request line, "GET /path?query HTTP/1.1"
+  void answer(Conn *c, const std::string& line)
+  {
+    requests++;
+    std::size_t sp1 = line.find(' ');
+    std::size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+      respond(c, 400, "text/plain", "bad request line\n");
+      return;
+    }
+    std::string path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string query;
+    std::size_t q = path.find('?');
+    if (q != std::string::npos) {
+      query = path.substr(q + 1);
+      path.erase(q);
+    }
+    if (line.compare(0, sp1, "GET") != 0) {
+      respond(c, 405, "text/plain", "only GET\n");
+      return;
+    }
+
+    uint64_t sensor, t0, t1, level = 0;
+    if (path != "/raw" && path != "/summary") {
+      respond(c, 404, "text/plain", "no such endpoint\n");
+      return;
+    }
+    if (!numberParam(query, "sensor", sensor) || sensor >= Sensors::size ||
+        !numberParam(query, "from", t0) || !numberParam(query, "to", t1) ||
+        t1 < t0 || (path == "/summary" &&
+                    (!numberParam(query, "level", level) ||
+                     level >= NUM_LEVELS))) {
+      respond(c, 400, "text/plain", "expected sensor, from, to"
+              " (and level for /summary)\n");
+      return;
+    }
+
+    uint64_t since = 0;
+    if (!queryParam(query, "since").empty() &&
+        !numberParam(query, "since", since)) {
+      respond(c, 400, "text/plain", "bad since\n");
+      return;
+    }
+
+    std::string body;
+    uint64_t next = 0;
+    if (path == "/raw") {
+      bool csv = queryParam(query, "format") == "csv";
+      next = rawRecords((int)sensor, t0, t1, since, csv, body);
+      respond(c, 200, csv ? "text/csv" : "application/octet-stream", body,
+              next);
+    } else {
+      next = summaryCells((int)sensor, (int)level, t0, t1, since, body);
+      respond(c, 200, "application/json", body, next);
+    }
+  }
+
+  //
+  // Visit the archived windows of `sensor` that overlap [t0, t1] (s) and
+  // start at `since` or later, until `body` holds `kMaxBody` bytes. Cuts
+  // only between seconds, so the rest starts past `since` even when one
+  // second alone holds more. Returns 0 if all were visited, otherwise the
+  // timestamp of the first one left out.
+  //
+  template <typename F>
+  uint64_t overlapping(int sensor, uint64_t t0, uint64_t t1, uint64_t since,
+                       const std::string& body, F fn)
+  {
+    uint64_t from = t0 > (uint64_t)_windowSeconds ? t0 - _windowSeconds : 0;
+    from = std::max(from, since);
+    uint64_t next = 0;
+    uint64_t last = 0; // second of the last record visited
+    bool any = false;
+    _archive.scanWhile(sensor, from, t1, [&](const Archive::RecordView& r) {
+      uint64_t endMs = r.hdr->timestamp * 1000 +
+          (uint64_t)r.hdr->numSamples * r.hdr->samplingPeriod;
+      if (endMs <= t0 * 1000)
+        return true;
+      if (any && r.hdr->timestamp > last && body.size() >= kMaxBody) {
+        next = r.hdr->timestamp;
+        return false;
+      }
+      fn(r);
+      last = r.hdr->timestamp;
+      any = true;
+      return true;
+    });
+    return next;
+  }
+
+  uint64_t rawRecords(int sensor, uint64_t t0, uint64_t t1, uint64_t since,
+                      bool csv, std::string& body)
+  {
+    return overlapping(sensor, t0, t1, since, body,
+                       [&](const Archive::RecordView& r) {
+      const Archive::RecordHeader *hdr = r.hdr;
+      if (!csv) {
+        body.append((const char *)hdr, sizeof(*hdr) +
+                    sizeof(float) * hdr->channels * hdr->numSamples);
+        return;
+      }
+      std::size_t used = body.size();
+      body.resize(used + Archive::csvBytes(*hdr));
+      char *end = Archive::formatCsv(&body[used], *hdr, r.columns);
+      body.resize(end - &body[0]);
+    });
+  }
+
+  uint64_t summaryCells(int sensor, int level, uint64_t t0, uint64_t t1,
+                        uint64_t since, std::string& body)
+  {
+    uint64_t next = 0;
+    forEachSensor<Sensors>([&](auto i) {
+      using S = SensorAt<decltype(i)::value, Sensors>;
+      const std::size_t C = S::channels;
+      if (sensor != (int)i)
+        return;
+
+      body = "{\"sensor\":\"" + std::string(S::name()) +
+             "\",\"span\":" + std::to_string(levelSpans[level]) +
+             ",\"cells\":[";
+      bool first = true;
+      SummaryPyramid<C> pyramid(level);
+      next = overlapping(sensor, t0, t1, since, body,
+                         [&](const Archive::RecordView& r) {
+        if (r.hdr->channels != C)
+          return;
+        uint64_t origin = r.hdr->timestamp * 1000;
+        float v[C];
+        pyramid.reset(origin);
+        for (uint32_t j = 0; j < r.hdr->numSamples; j++) {
+          for (std::size_t ch = 0; ch < C; ch++)
+            v[ch] = r.channel(ch)[j];
+          pyramid.add(v, origin + (uint64_t)j * r.hdr->samplingPeriod);
+        }
+        pyramid.finish();
+        for (const auto& cell : pyramid.cells[level]) {
+          if (cell.t0 < t0 * 1000 || cell.t0 > t1 * 1000)
+            continue;
+          if (!first)
+            body += ",";
+          appendCellJson<S>(body, cell);
+          first = false;
+        }
+      });
+      body += "]}";
+    });
+    return next;
+  }
+
+  Loop& _loop;
+  Archive& _archive;
+  int _windowSeconds;
+  int _fd;
+  void *_watch;
+  std::set<Conn *> _conns;
+};
+
+#endif /* __FETCH_H__ */
@@ -0,0 +1,65 @@
+#ifndef __FORMAT_H__
+#define __FORMAT_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+
+//
+// Number formatting for hot paths (recorder, live stream), where
+// iostreams and `std::to_string` cost more than the I/O.
+//
+
+//
+// Append the shortest "%.4f"-style text of `v` at `p` (trailing zeros
+// dropped), and return the end. Writes at most 24 chars. Values outside
+// what fits a 64-bit fixed point, NaN and infinities go through snprintf.
+//
+inline char *formatFloat(char *p, float v)
+{
+  double d = v;
+  if (!(std::fabs(d) < 1e12)) {
+    return p + snprintf(p, 24, "%g", d);
+  }
+  uint64_t fixed = (uint64_t)(std::fabs(d) * 10000 + 0.5);
+  if (d < 0 && fixed)
+    *p++ = '-';
+  uint64_t whole = fixed / 10000;
+  unsigned frac = (unsigned)(fixed % 10000);
+
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + whole % 10);
+    whole /= 10;
+  } while (whole);
+  while (n)
+    *p++ = digits[--n];
+
+  if (frac) {
+    *p++ = '.';
+    for (unsigned div = 1000; frac; div /= 10) {
+      *p++ = (char)('0' + frac / div);
+      frac %= div;
+    }
+  }
+  return p;
+}
+
+inline char *formatInt(char *p, long long v)
+{
+  char digits[20];
+  int n = 0;
+  unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : v;
+  if (v < 0)
+    *p++ = '-';
+  do {
+    digits[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  while (n)
+    *p++ = digits[--n];
+  return p;
+}
+
+#endif /* __FORMAT_H__ */
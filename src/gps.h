@@ -0,0 +1,167 @@
+#ifndef __GPS_H__
+#define __GPS_H__
+
+#include <cmath>
+#include <cstdint>
+
+#include "platform.h"
+
+// When to ask for position fixes; `period == 0` means not at all
+struct GpsPlan {
+  int period; // s
+  int method;
+};
+
+//
+// Location scheduler driven by the accelerometer.
+//
+// Stored accelerometer samples are cut into blocks of `blockMs`; a block
+// is moving when the standard deviation of the acceleration magnitude in
+// it exceeds `motionStd` (gravity and orientation drop out, steps and
+// vehicle vibration do not). O(1) per sample. From the runs of moving
+// and still blocks the wearer is
+//
+//   unknown     no samples yet: the profile's GPS period
+//   moving      `moveAfterMs` of motion in a row: the period shrinks by
+//               `movingDivisor` (to no less than `minPeriod`); right after
+//               leaving a stationary state, `boostMs` of GPS-only fixes
+//               pin down where the trip starts
+//   stationary  `stillAfterMs` without motion: the period grows by
+//               `stationaryScale`
+//   off         still `offAfterMs` and a fix was taken while stationary:
+//               the location is known, so the location manager stops
+//
+// Brief motion (turning over in bed) restarts the still count but does
+// not leave the stationary state. Time is the sample clock, so replayed
+// traces behave exactly like live data.
+//
+struct GpsScheduler {
+  enum { UNKNOWN, MOVING, STATIONARY, OFF };
+
+  int blockMs = 1000;
+  float motionStd = 0.15f;       // m/s^2
+  int64_t moveAfterMs = 5000;
+  int64_t stillAfterMs = 60000;
+  int64_t offAfterMs = 600000;
+  int64_t boostMs = 30000;
+  int movingDivisor = 6;
+  int minPeriod = 10;            // s
+  int stationaryScale = 5;
+
+  GpsScheduler() { reset(); }
+
+  // Back to `UNKNOWN`, e.g. when sampling stops
+  void reset()
+  {
+    _state = UNKNOWN;
+    _nowMs = 0;
+    _blockMs = 0;
+    _n = 0;
+    _sum = _sumSq = 0;
+    _movingMs = _stillMs = 0;
+    _boostUntil = -1;
+    _fixWhileStill = false;
+  }
+
+  int state() const { return _state; }
+  bool boosting() const { return _boostUntil >= 0; }
+  int64_t now() const { return _nowMs; }
+
+  //
+  // One stored accelerometer sample (x, y, z), `periodMs` after the
+  // previous one. Returns true when the plan may have changed.
+  //
+  bool feed(const float *v, int periodMs)
+  {
+    double mag = std::sqrt((double)v[0] * v[0] + (double)v[1] * v[1] +
+                           (double)v[2] * v[2]);
+    _sum += mag;
+    _sumSq += mag * mag;
+    _n++;
+    _nowMs += periodMs;
+    _blockMs += periodMs;
+    if (_blockMs < blockMs)
+      return false;
+
+    double mean = _sum / _n;
+    double var = _sumSq / _n - mean * mean;
+    bool moving = var > (double)motionStd * motionStd;
+    int64_t len = _blockMs;
+    _blockMs = 0;
+    _n = 0;
+    _sum = _sumSq = 0;
+    return block(moving, len);
+  }
+
+  // A position fix arrived
+  void fixed()
+  {
+    if (_state == STATIONARY)
+      _fixWhileStill = true;
+  }
+
+  // What to do under a power profile allowing fixes every `basePeriod` s
+  GpsPlan plan(int basePeriod) const
+  {
+    if (basePeriod <= 0)
+      return GpsPlan{0, LOCATION_HYBRID};
+    switch (_state) {
+    case MOVING: {
+      int period = basePeriod / movingDivisor;
+      if (period < minPeriod)
+        period = minPeriod < basePeriod ? minPeriod : basePeriod;
+      return GpsPlan{period, boosting() ? LOCATION_GPS : LOCATION_HYBRID};
+    }
+    case STATIONARY:
+      return GpsPlan{basePeriod * stationaryScale, LOCATION_HYBRID};
+    case OFF:
+      return GpsPlan{0, LOCATION_HYBRID};
+    default:
+      return GpsPlan{basePeriod, LOCATION_HYBRID};
+    }
+  }
+
+private:
+  bool block(bool moving, int64_t len)
+  {
+    int state = _state;
+    bool boost = boosting();
+    if (boost && _nowMs >= _boostUntil)
+      _boostUntil = -1;
+
+    if (moving) {
+      _movingMs += len;
+      _stillMs = 0;
+      if (_state != MOVING && _movingMs >= moveAfterMs) {
+        if (_state == STATIONARY || _state == OFF)
+          _boostUntil = _nowMs + boostMs;
+        _state = MOVING;
+      }
+    } else {
+      _stillMs += len;
+      _movingMs = 0;
+      if ((_state == UNKNOWN || _state == MOVING) &&
+          _stillMs >= stillAfterMs) {
+        _state = STATIONARY;
+        _fixWhileStill = false;
+        _boostUntil = -1;
+      } else if (_state == STATIONARY && _fixWhileStill &&
+                 _stillMs >= offAfterMs) {
+        _state = OFF;
+      }
+    }
+    return _state != state || boosting() != boost;
+  }
+
+  int _state;
+  int64_t _nowMs;    // sample clock
+  int _blockMs;      // of the current block
+  int _n;
+  double _sum, _sumSq;
+  int64_t _movingMs; // consecutive moving / still time
+  int64_t _stillMs;
+  int64_t _boostUntil; // -1: not boosting
+  bool _fixWhileStill;
+};
+
+#endif /* __GPS_H__ */
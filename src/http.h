@@ -0,0 +1,433 @@
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <string>
+#include <deque>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+#include <curl/curl.h>
+
+#include "loop.h"
+
+struct HttpResult {
+  CURLcode code;
+  long status;
+  double seconds; // submit -> completion, including earlier attempts
+  std::string response;
+
+  bool ok() const { return code == CURLE_OK && status >= 200 && status < 300; }
+};
+
+struct HttpRequest {
+  std::string url;
+  std::string body;
+  std::string contentType = "application/json";
+  std::string contentEncoding; // e.g. "gzip" if `body` is compressed
+  int attempt = 0;
+
+  // Called once, on success or when the retry policy gives up
+  std::function<void(const HttpRequest&, const HttpResult&)> done;
+};
+
+struct HttpMetrics {
+  uint64_t submitted = 0;
+  uint64_t succeeded = 0;
+  uint64_t failed = 0;   // given up
+  uint64_t retried = 0;
+  uint64_t bytesSent = 0;
+  double latencySum = 0; // s, over succeeded requests
+  unsigned inFlight = 0;
+  unsigned pending = 0;
+};
+
+//
+// A curl multi handle driven by a `Loop`: curl's sockets are watched on
+// the loop and its single timeout is a loop timer. After every
+// `curl_multi_socket_action`, `progress(data)` runs so the owner can
+// collect finished transfers with `curl_multi_info_read(handle, ...)`.
+// The owner removes its easy handles before this is destroyed.
+//
+struct CurlMulti {
+  CURLM *const handle;
+
+  CurlMulti(Loop& loop, void (*progress)(void *), void *data)
+    : handle(curl_multi_init()), _loop(loop), _progress(progress),
+      _data(data), _timer(nullptr)
+  {
+    curl_multi_setopt(handle, CURLMOPT_SOCKETFUNCTION, socketCb);
+    curl_multi_setopt(handle, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(handle, CURLMOPT_TIMERFUNCTION, timerCb);
+    curl_multi_setopt(handle, CURLMOPT_TIMERDATA, this);
+  }
+
+  ~CurlMulti()
+  {
+    curl_multi_cleanup(handle); // may still call `socketCb` and `timerCb`
+    if (_timer)
+      _loop.delTimer(_timer);
+  }
+
+  CurlMulti(const CurlMulti&) = delete;
+  CurlMulti& operator=(const CurlMulti&) = delete;
+
+private:
+  void act(curl_socket_t s, int flags)
+  {
+    int running;
+    curl_multi_socket_action(handle, s, flags, &running);
+    _progress(_data);
+  }
+
+  static void fdCb(void *data, int fd, int events)
+  {
+    int flags = 0;
+    if (events & Loop::READ)
+      flags |= CURL_CSELECT_IN;
+    if (events & Loop::WRITE)
+      flags |= CURL_CSELECT_OUT;
+    ((CurlMulti *)data)->act(fd, flags);
+  }
+
+  static bool timeoutCb(void *data)
+  {
+    CurlMulti *self = (CurlMulti *)data;
+    self->_timer = nullptr;
+    self->act(CURL_SOCKET_TIMEOUT, 0);
+    return false;
+  }
+
+  // CURLMOPT_SOCKETFUNCTION: (un)register `s` with the loop
+  static int socketCb(CURL *, curl_socket_t s, int what, void *userp,
+                      void *socketp)
+  {
+    CurlMulti *self = (CurlMulti *)userp;
+    if (what == CURL_POLL_REMOVE) {
+      if (socketp)
+        self->_loop.unwatchFd(socketp);
+      curl_multi_assign(self->handle, s, nullptr);
+      return 0;
+    }
+
+    int events = 0;
+    if (what & CURL_POLL_IN)
+      events |= Loop::READ;
+    if (what & CURL_POLL_OUT)
+      events |= Loop::WRITE;
+    if (socketp) {
+      self->_loop.modifyFd(socketp, events);
+    } else {
+      void *watch = self->_loop.watchFd(s, events, fdCb, self);
+      curl_multi_assign(self->handle, s, watch);
+    }
+    return 0;
+  }
+
+  // CURLMOPT_TIMERFUNCTION: (re)arm the single multi timeout
+  static int timerCb(CURLM *, long timeoutMs, void *userp)
+  {
+    CurlMulti *self = (CurlMulti *)userp;
+    if (self->_timer) {
+      self->_loop.delTimer(self->_timer);
+      self->_timer = nullptr;
+    }
+    if (timeoutMs >= 0)
+      self->_timer = self->_loop.addTimer(timeoutMs / 1000.0, timeoutCb, self);
+    return 0;
+  }
+
+  Loop& _loop;
+  void (*_progress)(void *);
+  void *_data;
+  void *_timer;
+};
+
+//
+// Asynchronous HTTP POST engine on top of the curl multi interface.
+//
+// curl's sockets and timeout are registered with a `Loop`, so many
+// requests are in flight at once without a thread per request and without
+// ever blocking the loop. At most `maxInFlight` transfers run concurrently;
+// the rest wait in `_pending`.
+//
+// Every finished attempt goes through `retryPolicy` (delay before the next
+// attempt, or < 0 to give up) and then `onComplete`, which is where
+// callers hook their own metrics. `curl_global_init` must have been called.
+//
+struct HttpEngine {
+  typedef std::chrono::steady_clock Clock;
+
+  std::function<double(const HttpRequest&, const HttpResult&)> retryPolicy;
+  std::function<void(const HttpRequest&, const HttpResult&)> onComplete;
+  HttpMetrics metrics;
+
+  HttpEngine(Loop& loop, unsigned maxInFlight = 8)
+    : retryPolicy(defaultRetryPolicy), _loop(loop),
+      _multi(loop, progressCb, this), _maxInFlight(maxInFlight),
+      _inbox(new Inbox())
+  {
+    _inbox->engine = this;
+  }
+
+  ~HttpEngine()
+  {
+    // A `drainInbox` already posted to the loop can't be taken back: it
+    // inherits the inbox and finds the engine gone
+    bool orphaned;
+    {
+      std::lock_guard<std::mutex> lk(_inbox->m);
+      _inbox->engine = nullptr;
+      _inbox->requests.clear();
+      orphaned = _inbox->posted;
+    }
+    if (!orphaned)
+      delete _inbox;
+
+    for (Transfer *t : _live) {
+      if (t->easy) {
+        curl_multi_remove_handle(_multi.handle, t->easy);
+        curl_easy_cleanup(t->easy);
+      }
+      if (t->retryTimer)
+        _loop.delTimer(t->retryTimer);
+      curl_slist_free_all(t->headers);
+      delete t;
+    }
+  }
+
+  HttpEngine(const HttpEngine&) = delete;
+  HttpEngine& operator=(const HttpEngine&) = delete;
+
+  // Queue a request. Must be called from the loop thread.
+  void submit(HttpRequest req)
+  {
+    Transfer *t = new Transfer();
+    t->req = std::move(req);
+    t->submitted = Clock::now();
+    _live.insert(t);
+    metrics.submitted++;
+    _pending.push_back(t);
+    metrics.pending = _pending.size();
+    startPending();
+  }
+
+  // Queue a request from any thread; it is submitted on the loop thread.
+  void post(HttpRequest req)
+  {
+    std::lock_guard<std::mutex> lk(_inbox->m);
+    _inbox->requests.push_back(std::move(req));
+    if (!_inbox->posted) {
+      _inbox->posted = true;
+      _loop.post(drainInbox, _inbox);
+    }
+  }
+
+  // Submit what `post` has queued right away, e.g. before the engine is
+  // destroyed. Must be called from the loop thread.
+  void flush()
+  {
+    std::vector<HttpRequest> requests;
+    {
+      std::lock_guard<std::mutex> lk(_inbox->m);
+      requests.swap(_inbox->requests);
+    }
+    for (HttpRequest& req : requests)
+      submit(std::move(req));
+  }
+
+  // Requests not finished yet: queued, in flight or waiting for a retry
+  std::size_t busy()
+  {
+    std::lock_guard<std::mutex> lk(_inbox->m);
+    return _live.size() + _inbox->requests.size();
+  }
+
+  //
+  // Retry transport errors, 5xx, 408 and 429 with exponential backoff
+  // (0.5 s, 1 s, 2 s, ... capped at 30 s), up to 5 attempts.
+  //
+  static double defaultRetryPolicy(const HttpRequest& req, const HttpResult& res)
+  {
+    if (res.ok() || req.attempt >= 5)
+      return -1;
+    if (res.code == CURLE_OK && res.status < 500 &&
+        res.status != 408 && res.status != 429)
+      return -1;
+    double delay = 0.5 * (1 << (req.attempt - 1));
+    return delay > 30 ? 30 : delay;
+  }
+
+private:
+  struct Transfer {
+    HttpEngine *engine = nullptr;
+    HttpRequest req;
+    CURL *easy = nullptr;
+    struct curl_slist *headers = nullptr;
+    void *retryTimer = nullptr;
+    std::string response;
+    Clock::time_point submitted;
+  };
+
+  void startPending()
+  {
+    while (metrics.inFlight < _maxInFlight && !_pending.empty()) {
+      Transfer *t = _pending.front();
+      _pending.pop_front();
+      start(t);
+    }
+    metrics.pending = _pending.size();
+  }
+
+  void start(Transfer *t)
+  {
+    t->engine = this;
+    t->req.attempt++;
+    t->response.clear();
+    if (!t->headers) {
+      std::string contentType = "Content-Type: " + t->req.contentType;
+      t->headers = curl_slist_append(t->headers, contentType.c_str());
+      t->headers = curl_slist_append(t->headers, "charsets: utf-8");
+      if (!t->req.contentEncoding.empty()) {
+        std::string encoding = "Content-Encoding: " + t->req.contentEncoding;
+        t->headers = curl_slist_append(t->headers, encoding.c_str());
+      }
+    }
+
+    CURL *easy = curl_easy_init();
+    curl_easy_setopt(easy, CURLOPT_URL, t->req.url.c_str());
+    curl_easy_setopt(easy, CURLOPT_POST, 1L);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, t->headers);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, t->req.body.data());
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, (long)t->req.body.size());
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, writeCb);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, t);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT, 60L);
+    t->easy = easy;
+
+    metrics.inFlight++;
+    curl_multi_add_handle(_multi.handle, easy);
+  }
+
+  void checkDone()
+  {
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(_multi.handle, &left))) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      CURL *easy = msg->easy_handle;
+      Transfer *t;
+      curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&t);
+
+      HttpResult res;
+      res.code = msg->data.result;
+      res.status = 0;
+      curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &res.status);
+      res.seconds = std::chrono::duration<double>(Clock::now() -
+                                                  t->submitted).count();
+      res.response.swap(t->response);
+
+      curl_multi_remove_handle(_multi.handle, easy);
+      curl_easy_cleanup(easy);
+      t->easy = nullptr;
+      metrics.inFlight--;
+
+      finish(t, res);
+    }
+    startPending();
+  }
+
+  void finish(Transfer *t, const HttpResult& res)
+  {
+    double delay = retryPolicy ? retryPolicy(t->req, res) : -1;
+    if (onComplete)
+      onComplete(t->req, res);
+
+    if (delay >= 0) {
+      metrics.retried++;
+      t->retryTimer = _loop.addTimer(delay, retryCb, t);
+      return;
+    }
+
+    if (res.ok()) {
+      metrics.succeeded++;
+      metrics.bytesSent += t->req.body.size();
+      metrics.latencySum += res.seconds;
+    } else {
+      metrics.failed++;
+    }
+    if (t->req.done)
+      t->req.done(t->req, res);
+
+    _live.erase(t);
+    curl_slist_free_all(t->headers);
+    delete t;
+  }
+
+  static bool retryCb(void *data)
+  {
+    Transfer *t = (Transfer *)data;
+    t->retryTimer = nullptr;
+    t->engine->_pending.push_back(t);
+    t->engine->startPending();
+    return false;
+  }
+
+  // Posted by `post` with the `Inbox`, which outlives the engine if need be
+  static void drainInbox(void *data)
+  {
+    Inbox *inbox = (Inbox *)data;
+    std::vector<HttpRequest> requests;
+    HttpEngine *self;
+    {
+      std::lock_guard<std::mutex> lk(inbox->m);
+      requests.swap(inbox->requests);
+      inbox->posted = false;
+      self = inbox->engine;
+    }
+    if (!self) {
+      delete inbox;
+      return;
+    }
+    for (HttpRequest& req : requests)
+      self->submit(std::move(req));
+  }
+
+  static size_t writeCb(char *ptr, size_t size, size_t nmemb, void *userdata)
+  {
+    Transfer *t = (Transfer *)userdata;
+    t->response.append(ptr, size * nmemb);
+    return size * nmemb;
+  }
+
+  // `CurlMulti` progress: collect finished transfers
+  static void progressCb(void *data)
+  {
+    ((HttpEngine *)data)->checkDone();
+  }
+
+  Loop& _loop;
+  CurlMulti _multi;
+  unsigned _maxInFlight;
+  std::deque<Transfer *> _pending;
+  std::set<Transfer *> _live;
+
+  // Requests posted from other threads, waiting for `drainInbox`
+  struct Inbox {
+    std::mutex m;
+    std::vector<HttpRequest> requests;
+    bool posted = false; // a `drainInbox` is on its way
+    HttpEngine *engine;  // nullptr once the engine is gone
+  };
+  Inbox *_inbox;
+};
+
+#endif /* __HTTP_H__ */
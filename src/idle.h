@@ -0,0 +1,185 @@
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include <string>
+#include <memory>
+#include <sstream>
+#include <cstdint>
+
+#include "data.h"
+#include "archive.h"
+
+//
+// Noise floor of one sensor, in its own units. A window whose every
+// channel stays within `range` (max - min) and `std` (standard deviation)
+// carries nothing but the sensor's noise and the orientation of a still
+// arm: it is idle.
+//
+struct IdleFloor {
+  float std;
+  float range;
+};
+
+//
+// A run of consecutive idle windows of sensor `S`, collapsed into their
+// mean: "idle from `_timestamp` to `_endMs` at `_mean`". It goes through
+// the queue, archive, recording and spill file like a window holding a
+// single sample that lasts the whole run (`_period`); its records carry
+// kind `MEASURE_IDLE` to tell it from a one-sample window.
+//
+template <typename S>
+struct IdleRun : MeasureBase {
+  static const std::size_t C = S::channels;
+
+  unsigned long long _endMs;
+  uint64_t _n; // samples merged
+  double _sum[C];
+  float _mean[C];
+
+  IdleRun(int id, int type, int context, unsigned long long timestamp,
+          int profile)
+    : MeasureBase(id, type, context, timestamp, 0),
+      _endMs(timestamp * 1000), _n(0)
+  {
+    _kind = MEASURE_IDLE;
+    _profile = profile;
+    _nextIdx = 1;
+    _done = true;
+    for (std::size_t c = 0; c < C; c++) {
+      _sum[c] = 0;
+      _mean[c] = 0;
+    }
+  }
+
+  // Append the `n` samples summarized by `total`, lasting until `endMs`
+  void add(const SummaryCell<C>& total, unsigned long long endMs)
+  {
+    _n += total.n;
+    for (std::size_t c = 0; c < C; c++) {
+      _sum[c] += total.sum[c];
+      _mean[c] = _n ? (float)(_sum[c] / _n) : 0;
+    }
+    if (endMs > _endMs)
+      _endMs = endMs;
+  }
+
+  // The run as saved by `Archive::append` or `SpillFile::write`
+  static std::unique_ptr<MeasureBase>
+  unspill(const Archive::RecordHeader& hdr, const float *columns)
+  {
+    if (hdr.channels != C || hdr.numSamples != 1)
+      return nullptr;
+    std::unique_ptr<IdleRun> run(new IdleRun(hdr.id, hdr.sensor, hdr.context,
+                                             hdr.timestamp, 0));
+    run->_endMs = hdr.timestamp * 1000 + hdr.samplingPeriod;
+    run->_n = 1;
+    for (std::size_t c = 0; c < C; c++) {
+      run->_sum[c] = columns[c];
+      run->_mean[c] = columns[c];
+    }
+    return std::unique_ptr<MeasureBase>(std::move(run));
+  }
+
+  std::size_t _numChannels() const override { return C; }
+  int _period() const override { return (int)(_endMs - _timestamp * 1000); }
+  const float *_channel(std::size_t c) const override { return &_mean[c]; }
+  std::size_t _bytes() const override { return sizeof(*this); }
+
+  std::string format() override
+  {
+    std::ostringstream oss;
+    oss << _id << ',' << _context << ',' << _type;
+    for (std::size_t c = 0; c < C; c++)
+      oss << ',' << _mean[c];
+    return oss.str();
+  }
+
+  //
+  // {..., "kind":"idle", "end":<s>,
+  //  "<S::name()>":{"<S::axis(0)>":<mean>, ...}}
+  //
+  std::string formatJson() override
+  {
+    std::string jsonObj = "{\"user_id\":" + std::to_string(_userId) +
+        ", \"id\":" + std::to_string(_id) +
+        ",\"timestamps\":" + std::to_string(_timestamp) +
+        ",\"kind\":\"idle\"" +
+        ",\"profile\":" + std::to_string(_profile) +
+        ",\"end\":" + std::to_string((_endMs + 500) / 1000) +
+        ",\"" + S::name() + "\":{";
+    for (std::size_t c = 0; c < C; c++) {
+      if (c)
+        jsonObj += ",";
+      jsonObj += "\"";
+      jsonObj += S::axis(c);
+      jsonObj += "\":" + std::to_string(_mean[c]);
+    }
+    jsonObj += "}}";
+    return jsonObj;
+  }
+
+  // A run is already as compact as it gets
+  std::string formatSummaryJson() override { return formatJson(); }
+  std::string formatPyramidJson() override { return formatJson(); }
+};
+
+//
+// Idle detection on the window-close path of sensor `S`. The statistics
+// come from the window's summary pyramid, which `tick` keeps up to date,
+// so checking a finished window is O(channels). Idle windows are folded
+// into an open `IdleRun` instead of being kept; the caller hands the run
+// over with `take` when a busy window breaks it, when it reaches
+// `maxWindows`, or when sampling stops or changes rate.
+//
+template <typename S>
+struct IdleSuppressor {
+  IdleFloor floor = {0, 0};
+  int maxWindows = 60;
+
+  uint64_t absorbed = 0; // idle windows so far
+  uint64_t runs = 0;     // runs handed over
+
+  // Fold `w` into the open run if it is idle; the caller then drops it
+  template <std::size_t D>
+  bool absorb(Measure<S, D>& w)
+  {
+    if (w._kind != MEASURE_WINDOW || w._events || w._numSamples() == 0)
+      return false;
+    if (_run && w._profile != _run->_profile)
+      return false;
+    w._summary.finish();
+    SummaryCell<S::channels> total = w._summary.total();
+    for (std::size_t c = 0; c < S::channels; c++) {
+      if (total.max[c] - total.min[c] > floor.range ||
+          total.variance(c) > (double)floor.std * floor.std)
+        return false;
+    }
+
+    if (!_run) {
+      _run.reset(new IdleRun<S>(w._id, w._type, w._context, w._timestamp,
+                                w._profile));
+    }
+    _run->add(total, w._timestamp * 1000 +
+                         (unsigned long long)w._numSamples() * w._period());
+    _windows++;
+    absorbed++;
+    return true;
+  }
+
+  bool full() const { return _run && _windows >= maxWindows; }
+
+  // End the open run, if any, and hand it over
+  std::unique_ptr<IdleRun<S>> take()
+  {
+    if (_run)
+      runs++;
+    _windows = 0;
+    return std::move(_run);
+  }
+
+private:
+  std::unique_ptr<IdleRun<S>> _run;
+  int _windows = 0;
+};
+
+#endif /* __IDLE_H__ */
@@ -0,0 +1,260 @@
+#ifndef __LOOP_H__
+#define __LOOP_H__
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+//
+// Minimal main-loop interface, so that code driven by fd readiness and
+// timers (e.g. `HttpEngine`) runs unchanged on the Ecore main loop on the
+// watch (see ecore-loop.h) and on a plain epoll loop on the host.
+//
+// Callbacks follow the Ecore convention of a C function plus `void *data`.
+// A timer whose callback returned false is gone and must not be passed to
+// `delTimer`; a timer stops itself by returning false, never by calling
+// `delTimer` from its own callback. All methods except `post` must be
+// called from the loop thread.
+//
+struct Loop {
+  enum { READ = 1, WRITE = 2 };
+
+  typedef void (*FdCb)(void *data, int fd, int events);
+  typedef bool (*TimerCb)(void *data); // return true to keep repeating
+  typedef void (*PostCb)(void *data);
+
+  virtual ~Loop() {}
+
+  virtual void *watchFd(int fd, int events, FdCb cb, void *data) = 0;
+  virtual void modifyFd(void *handle, int events) = 0;
+  virtual void unwatchFd(void *handle) = 0;
+
+  virtual void *addTimer(double seconds, TimerCb cb, void *data) = 0;
+  virtual void delTimer(void *handle) = 0;
+
+  // Run `cb(data)` on the loop thread. Safe to call from any thread.
+  virtual void post(PostCb cb, void *data) = 0;
+};
+
+//
+// epoll(7)-based `Loop` for host builds and tools. Handles removed while
+// events are being dispatched are freed only after the dispatch round.
+//
+struct EpollLoop : Loop {
+  EpollLoop() : _quit(false)
+  {
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // wakeup
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakeFd, &ev);
+  }
+
+  ~EpollLoop()
+  {
+    for (Watch *w : _graveyard)
+      delete w;
+    while (!_timers.empty()) {
+      delete _timers.top().second;
+      _timers.pop();
+    }
+    close(_wakeFd);
+    close(_epfd);
+  }
+
+  void *watchFd(int fd, int events, FdCb cb, void *data) override
+  {
+    Watch *w = new Watch{fd, cb, data};
+    struct epoll_event ev = {};
+    ev.events = toEpoll(events);
+    ev.data.ptr = w;
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      delete w;
+      return nullptr;
+    }
+    return w;
+  }
+
+  void modifyFd(void *handle, int events) override
+  {
+    Watch *w = (Watch *)handle;
+    struct epoll_event ev = {};
+    ev.events = toEpoll(events);
+    ev.data.ptr = w;
+    epoll_ctl(_epfd, EPOLL_CTL_MOD, w->fd, &ev);
+  }
+
+  void unwatchFd(void *handle) override
+  {
+    Watch *w = (Watch *)handle;
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, w->fd, nullptr);
+    w->cb = nullptr;
+    _graveyard.push_back(w);
+  }
+
+  void *addTimer(double seconds, TimerCb cb, void *data) override
+  {
+    Timer *t = new Timer{std::chrono::duration<double>(seconds), cb, data,
+                         false};
+    schedule(t, Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                   t->interval));
+    return t;
+  }
+
+  void delTimer(void *handle) override
+  {
+    // Lazily removed from the heap when it comes up
+    ((Timer *)handle)->dead = true;
+  }
+
+  void post(PostCb cb, void *data) override
+  {
+    {
+      std::lock_guard<std::mutex> lk(_postMutex);
+      _posted.push_back(std::make_pair(cb, data));
+    }
+    uint64_t one = 1;
+    ssize_t n = write(_wakeFd, &one, sizeof(one));
+    (void)n;
+  }
+
+  void run()
+  {
+    _quit = false;
+    while (!_quit)
+      runOnce(-1);
+  }
+
+  void quit() { _quit = true; }
+
+  // Dispatch one round of events, waiting at most `timeoutMs` (-1: forever)
+  void runOnce(int timeoutMs)
+  {
+    int wait = timeoutMs;
+    int untilTimer = msUntilNextTimer();
+    if (untilTimer >= 0 && (wait < 0 || untilTimer < wait))
+      wait = untilTimer;
+
+    struct epoll_event events[64];
+    int n = epoll_wait(_epfd, events, 64, wait);
+    for (int i = 0; i < n; i++) {
+      Watch *w = (Watch *)events[i].data.ptr;
+      if (!w) {
+        uint64_t count;
+        ssize_t r = read(_wakeFd, &count, sizeof(count));
+        (void)r;
+        continue;
+      }
+      if (!w->cb)
+        continue; // unwatched earlier in this round
+      int ev = 0;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        ev |= READ;
+      if (events[i].events & EPOLLOUT)
+        ev |= WRITE;
+      w->cb(w->data, w->fd, ev);
+    }
+    for (Watch *w : _graveyard)
+      delete w;
+    _graveyard.clear();
+
+    fireTimers();
+    runPosted();
+  }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Watch {
+    int fd;
+    FdCb cb;
+    void *data;
+  };
+
+  struct Timer {
+    std::chrono::duration<double> interval;
+    TimerCb cb;
+    void *data;
+    bool dead;
+  };
+
+  typedef std::pair<Clock::time_point, Timer *> Deadline;
+  struct Later {
+    bool operator()(const Deadline& a, const Deadline& b) const
+    {
+      return a.first > b.first;
+    }
+  };
+
+  static uint32_t toEpoll(int events)
+  {
+    return ((events & READ) ? (int)EPOLLIN : 0) |
+           ((events & WRITE) ? (int)EPOLLOUT : 0);
+  }
+
+  void schedule(Timer *t, Clock::time_point when)
+  {
+    _timers.push(std::make_pair(when, t));
+  }
+
+  int msUntilNextTimer()
+  {
+    while (!_timers.empty() && _timers.top().second->dead) {
+      delete _timers.top().second;
+      _timers.pop();
+    }
+    if (_timers.empty())
+      return -1;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        _timers.top().first - Clock::now()).count();
+    return left < 0 ? 0 : (int)left + 1;
+  }
+
+  void fireTimers()
+  {
+    Clock::time_point now = Clock::now();
+    while (!_timers.empty() && _timers.top().first <= now) {
+      Timer *t = _timers.top().second;
+      _timers.pop();
+      if (t->dead) {
+        delete t;
+        continue;
+      }
+      if (t->cb(t->data) && !t->dead) {
+        schedule(t, now + std::chrono::duration_cast<Clock::duration>(
+                              t->interval));
+      } else {
+        delete t;
+      }
+    }
+  }
+
+  void runPosted()
+  {
+    std::vector<std::pair<PostCb, void *>> posted;
+    {
+      std::lock_guard<std::mutex> lk(_postMutex);
+      posted.swap(_posted);
+    }
+    for (auto& p : posted)
+      p.first(p.second);
+  }
+
+  int _epfd;
+  int _wakeFd;
+  bool _quit;
+  std::vector<Watch *> _graveyard;
+  std::priority_queue<Deadline, std::vector<Deadline>, Later> _timers;
+  std::mutex _postMutex;
+  std::vector<std::pair<PostCb, void *>> _posted;
+};
+
+#endif /* __LOOP_H__ */
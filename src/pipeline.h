@@ -0,0 +1,313 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+
+#include <pthread.h>
+
+#ifndef USE_ZLIB
+#define USE_ZLIB 1
+#endif
+
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "queue.h"
+
+//
+// Building blocks of the upload path: stages running on their own
+// threads, connected by bounded `Queue`s. Items are handed over as
+// `unique_ptr`s, so a buffer is never copied between stages, and a full
+// queue blocks its producer, which keeps memory bounded when the network
+// is the bottleneck.
+//
+
+// One upload body on its way through the pipeline
+struct Payload {
+  std::string body;
+  std::string contentType = "application/json";
+  std::string contentEncoding;
+  std::size_t rawBytes = 0; // size before compression
+  int id = 0;
+  int type = 0;
+};
+
+//
+// Where the time of a stage thread goes:
+//   busy     running the stage function
+//   waitIn   waiting for input
+//   waitOut  blocked on a full output queue or other downstream limit
+// A stage with utilization close to 1 is the bottleneck; one that
+// mostly waits on output is held back by a later stage.
+//
+struct StageMetrics {
+  std::atomic<uint64_t> items{0};
+  std::atomic<uint64_t> busyUs{0};
+  std::atomic<uint64_t> waitInUs{0};
+  std::atomic<uint64_t> waitOutUs{0};
+
+  double utilization() const
+  {
+    double total = (double)busyUs + waitInUs + waitOutUs;
+    return total > 0 ? busyUs / total : 0;
+  }
+};
+
+//
+// Runs `fn` on every item taken from `in` on a dedicated thread and
+// pushes the results into `out` (if any). `fn` may return nullptr to
+// consume an item. Once `in` is drained the stage calls `drainDone` on
+// `out`, so shutting down the first queue shuts down the whole chain.
+//
+template <typename In, typename Out, std::size_t P = 1>
+struct Stage {
+  typedef std::chrono::steady_clock Clock;
+  typedef std::function<std::unique_ptr<Out>(std::unique_ptr<In>)> Fn;
+
+  const char *name;
+  StageMetrics metrics;
+
+  Stage(const char *name, Queue<In, P>& in, Queue<Out> *out, Fn fn,
+        std::size_t batch = 16)
+    : name(name), _in(in), _out(out), _fn(fn), _batch(batch),
+      _running(false) {}
+
+  ~Stage() { join(); }
+
+  Stage(const Stage&) = delete;
+  Stage& operator=(const Stage&) = delete;
+
+  bool start()
+  {
+    if (pthread_create(&_thread, nullptr, run, this) != 0)
+      return false;
+    _running = true;
+    return true;
+  }
+
+  void join()
+  {
+    if (_running) {
+      pthread_join(_thread, nullptr);
+      _running = false;
+    }
+  }
+
+  // Account time a stage function spent blocked downstream (e.g. waiting
+  // for `Credits`) as `waitOut` rather than `busy`
+  void blockedFor(uint64_t us) { metrics.waitOutUs += us; }
+
+  static uint64_t usSince(Clock::time_point t)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - t).count();
+  }
+
+private:
+  static void *run(void *data)
+  {
+    Stage *self = (Stage *)data;
+    std::vector<std::unique_ptr<In>> batch;
+
+    Clock::time_point t = Clock::now();
+    while (self->_in.dequeue_batch(batch, self->_batch,
+                                   std::chrono::seconds(1))) {
+      self->metrics.waitInUs += usSince(t);
+      for (auto& item : batch) {
+        t = Clock::now();
+        uint64_t blocked = self->metrics.waitOutUs;
+        std::unique_ptr<Out> result = self->_fn(std::move(item));
+        blocked = self->metrics.waitOutUs - blocked;
+        uint64_t spent = usSince(t);
+        self->metrics.busyUs += spent > blocked ? spent - blocked : 0;
+
+        if (result && self->_out) {
+          t = Clock::now();
+          self->_out->enqueue(std::move(result));
+          self->metrics.waitOutUs += usSince(t);
+        }
+        self->metrics.items++;
+      }
+      batch.clear();
+      t = Clock::now();
+    }
+
+    if (self->_out)
+      self->_out->drainDone();
+    return nullptr;
+  }
+
+  Queue<In, P>& _in;
+  Queue<Out> *_out;
+  Fn _fn;
+  std::size_t _batch;
+  pthread_t _thread;
+  bool _running;
+};
+
+//
+// Counting semaphore bounding how many items a stage may have
+// outstanding in an asynchronous consumer, e.g. requests handed to
+// `HttpEngine` that have not completed yet.
+//
+// `drain` lets `acquire` go through without waiting, for shutdowns where
+// the thread that would release credits is the one waiting for the stage.
+//
+struct Credits {
+  explicit Credits(int n) : _free(n), _draining(false) {}
+
+  // Blocks until a credit is free; returns the time waited (us)
+  uint64_t acquire()
+  {
+    auto t = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(_m);
+    _cv.wait(lk, [this]() { return _free > 0 || _draining; });
+    _free--;
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t).count();
+  }
+
+  void release()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _free++;
+    _cv.notify_one();
+  }
+
+  void drain()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _draining = true;
+    _cv.notify_all();
+  }
+
+  void reopen()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _draining = false;
+  }
+
+private:
+  std::mutex _m;
+  std::condition_variable _cv;
+  int _free; // negative while drained acquisitions are outstanding
+  bool _draining;
+};
+
+//
+// Lets a stage through in bursts, so the radio wakes up once per
+// `period` instead of once per item. `wait` blocks until the next burst
+// is due; the stage calls `burstDone` once it has nothing left to send,
+// which schedules the next burst `period` s later. A period of 0 never
+// blocks. `drain` stops blocking for good, as `Credits::drain`.
+//
+struct Cadence {
+  typedef std::chrono::steady_clock Clock;
+
+  Cadence() : _period(0), _draining(false), _next(Clock::now()) {}
+
+  void setPeriod(double period)
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    // Bring a far-off burst forward when switching to a shorter period
+    Clock::time_point due = Clock::now() +
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(period));
+    if (due < _next)
+      _next = due;
+    _period = period;
+    _cv.notify_all();
+  }
+
+  // Blocks until a burst is due; returns the time waited (us)
+  uint64_t wait()
+  {
+    auto t = Clock::now();
+    std::unique_lock<std::mutex> lk(_m);
+    while (!_draining && _period > 0 && Clock::now() < _next)
+      _cv.wait_until(lk, _next);
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - t).count();
+  }
+
+  void burstDone()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _next = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(_period));
+  }
+
+  void drain()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _draining = true;
+    _cv.notify_all();
+  }
+
+  void reopen()
+  {
+    std::lock_guard<std::mutex> lk(_m);
+    _draining = false;
+  }
+
+private:
+  std::mutex _m;
+  std::condition_variable _cv;
+  double _period; // s
+  bool _draining;
+  Clock::time_point _next;
+};
+
+//
+// gzip `p.body` in place if that makes it smaller. Bodies shorter than
+// `minBytes` (e.g. window summaries) are not worth the CPU and are left
+// alone. Returns true if the body was compressed.
+//
+inline bool gzipPayload(Payload& p, std::size_t minBytes = 1024, int level = 1)
+{
+  p.rawBytes = p.body.size();
+#if USE_ZLIB
+  if (p.body.size() < minBytes || !p.contentEncoding.empty())
+    return false;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // 15 + 16: gzip wrapper, as expected by `Content-Encoding: gzip`
+  if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  std::string out;
+  out.resize(deflateBound(&zs, p.body.size()));
+  zs.next_in = (Bytef *)p.body.data();
+  zs.avail_in = p.body.size();
+  zs.next_out = (Bytef *)&out[0];
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  std::size_t n = zs.total_out;
+  deflateEnd(&zs);
+
+  if (ret != Z_STREAM_END || n >= p.body.size())
+    return false;
+  out.resize(n);
+  p.body.swap(out);
+  p.contentEncoding = "gzip";
+  return true;
+#else
+  (void)minBytes;
+  (void)level;
+  return false;
+#endif
+}
+
+#endif /* __PIPELINE_H__ */
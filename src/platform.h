@@ -0,0 +1,56 @@
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+#include <string>
+#include <cstddef>
+#include <ctime>
+
+// Positioning method of a location request
+enum {
+  LOCATION_HYBRID, // GPS, Wi-Fi and cell: cheap, tens of meters
+  LOCATION_GPS     // satellites only: accurate, costly
+};
+
+//
+// Thin interface to the device services the data path needs, so that the
+// core (see collector.h) runs unchanged on the watch (tizen-platform.h)
+// and against simulated devices on the host (fake-platform.h).
+//
+// Sensors are identified by their index in the sensor list the
+// implementation was built for. Callbacks follow the `Loop` convention of
+// a C function plus `void *data` and are invoked on the loop thread.
+//
+struct Platform {
+  typedef void (*SampleCb)(const float *values, void *data);
+  typedef void (*LocationCb)(double latitude, double longitude,
+                             double altitude, time_t timestamp, void *data);
+  typedef void (*BatteryCb)(int percent, bool charging, void *data);
+
+  virtual ~Platform() {}
+
+  // Deliver samples of sensor `sensor` every `periodMs` until stopped
+  virtual bool startSensor(std::size_t sensor, int periodMs, SampleCb cb,
+                           void *data) = 0;
+  virtual void setSensorPeriod(std::size_t sensor, int periodMs) = 0;
+  virtual void stopSensor(std::size_t sensor) = 0;
+
+  // Keep the CPU awake (true) or let it sleep between events
+  virtual void setCpuLock(bool lock) = 0;
+
+  // Position fixes every `periodS` by `method` (`LOCATION_*`); calling
+  // again changes both
+  virtual bool startLocation(int periodS, int method, LocationCb cb,
+                             void *data) = 0;
+  virtual void stopLocation() = 0;
+
+  // Battery state now, then on every change until `unwatchBattery`
+  virtual int batteryPercent() = 0;
+  virtual bool batteryCharging() = 0;
+  virtual void watchBattery(BatteryCb cb, void *data) = 0;
+  virtual void unwatchBattery() = 0;
+
+  // Writable directory for local data, with a trailing '/'
+  virtual std::string dataPath() = 0;
+};
+
+#endif /* __PLATFORM_H__ */
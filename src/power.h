@@ -0,0 +1,107 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+//
+// Power profiles and the governor choosing between them.
+//
+// A profile slows everything that costs battery: how often the sensors
+// wake us up, how many samples we keep, how often the radio is used and
+// how often we ask for a location fix. Rates are given as multiples of
+// each sensor's own periods (see sensors.h), so every sensor keeps its
+// relative rate and window buffers stay valid (see `Measure`).
+//
+struct PowerProfile {
+  const char *name;
+  int deviceScale;     // x `S::devicePeriod`
+  int storedScale;     // x `S::storedPeriod`
+  double uploadPeriod; // s between upload bursts; 0 uploads right away
+  int gpsPeriod;       // s between location updates; 0 turns GPS off
+  bool cpuLock;        // keep the CPU awake while measuring
+};
+
+// Indexes into `powerProfiles`; recorded as `_profile` in every window
+enum {
+  PROFILE_FULL,
+  PROFILE_BALANCED,
+  PROFILE_SURVIVAL,
+  NUM_PROFILES
+};
+
+static const PowerProfile powerProfiles[NUM_PROFILES] = {
+  // name        device stored upload  gps  cpuLock
+  { "full",      1,     1,     0,      60,  true  },
+  { "balanced",  2,     2,     300,    180, true  },
+  { "survival",  5,     5,     1800,   0,   false },
+};
+
+//
+// Picks a profile from the battery level, with hysteresis so a level
+// hovering around a threshold doesn't flap between profiles. Charging
+// always means `PROFILE_FULL`. A low-battery event from the platform
+// forces `PROFILE_SURVIVAL` until the level has recovered past
+// `balancedAbove` (i.e. the watch was charged).
+//
+struct PowerGovernor {
+  int balancedBelow = 50; // % : full -> balanced
+  int survivalBelow = 20; // % : balanced -> survival
+  int hysteresis = 5;     // % above a threshold needed to step back up
+
+  PowerGovernor() : _profile(PROFILE_FULL), _percent(100), _charging(false),
+                    _lowEvent(false) {}
+
+  int profile() const { return _profile; }
+  const PowerProfile& current() const { return powerProfiles[_profile]; }
+
+  // New battery level or charging state; returns the profile to use
+  int update(int percent, bool charging)
+  {
+    _percent = percent;
+    _charging = charging;
+    if (charging || percent >= balancedBelow + hysteresis)
+      _lowEvent = false;
+    return _profile = select();
+  }
+
+  int updateLevel(int percent) { return update(percent, _charging); }
+  int updateCharging(bool charging) { return update(_percent, charging); }
+
+  // The platform reported a low battery
+  int lowBattery()
+  {
+    _lowEvent = true;
+    return _profile = select();
+  }
+
+private:
+  int select() const
+  {
+    if (_charging)
+      return PROFILE_FULL;
+    if (_lowEvent)
+      return PROFILE_SURVIVAL;
+
+    switch (_profile) {
+    case PROFILE_FULL:
+      if (_percent < survivalBelow)
+        return PROFILE_SURVIVAL;
+      return _percent < balancedBelow ? PROFILE_BALANCED : PROFILE_FULL;
+    case PROFILE_BALANCED:
+      if (_percent < survivalBelow)
+        return PROFILE_SURVIVAL;
+      return _percent >= balancedBelow + hysteresis ? PROFILE_FULL
+                                                    : PROFILE_BALANCED;
+    default:
+      if (_percent >= balancedBelow + hysteresis)
+        return PROFILE_FULL;
+      return _percent >= survivalBelow + hysteresis ? PROFILE_BALANCED
+                                                    : PROFILE_SURVIVAL;
+    }
+  }
+
+  int _profile;
+  int _percent;
+  bool _charging;
+  bool _lowEvent;
+};
+
+#endif /* __POWER_H__ */
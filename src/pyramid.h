@@ -0,0 +1,184 @@
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstddef>
+
+// Levels of a `SummaryPyramid`, finest first
+enum {
+  LEVEL_1S,
+  LEVEL_10S,
+  LEVEL_60S,
+  NUM_LEVELS
+};
+
+// ms covered by one cell of each level; each divides the next
+static const int levelSpans[NUM_LEVELS] = {1000, 10000, 60000};
+
+//
+// Per-channel min/max/sum/sum of squares of the samples in
+// [t0, t0 + span) of one level. Mean and energy (mean square) come out
+// of the sums, and two cells merge exactly, so coarse cells are built
+// from finer ones without going back to the samples.
+//
+template <std::size_t C>
+struct SummaryCell {
+  uint64_t t0; // ms
+  uint32_t n;  // samples
+  float min[C], max[C];
+  double sum[C], sumSq[C];
+
+  void start(uint64_t t)
+  {
+    t0 = t;
+    n = 0;
+    for (std::size_t c = 0; c < C; c++) {
+      min[c] = FLT_MAX;
+      max[c] = -FLT_MAX;
+      sum[c] = sumSq[c] = 0;
+    }
+  }
+
+  void add(const float *v)
+  {
+    for (std::size_t c = 0; c < C; c++) {
+      min[c] = std::min(min[c], v[c]);
+      max[c] = std::max(max[c], v[c]);
+      sum[c] += v[c];
+      sumSq[c] += (double)v[c] * v[c];
+    }
+    n++;
+  }
+
+  void merge(const SummaryCell& o)
+  {
+    for (std::size_t c = 0; c < C; c++) {
+      min[c] = std::min(min[c], o.min[c]);
+      max[c] = std::max(max[c], o.max[c]);
+      sum[c] += o.sum[c];
+      sumSq[c] += o.sumSq[c];
+    }
+    n += o.n;
+  }
+
+  double mean(std::size_t c) const { return n ? sum[c] / n : 0; }
+  double energy(std::size_t c) const { return n ? sumSq[c] / n : 0; }
+
+  double variance(std::size_t c) const
+  {
+    double m = mean(c);
+    return n ? std::max(0.0, sumSq[c] / n - m * m) : 0;
+  }
+};
+
+//
+// Summaries of one sample stream at 1 s, 10 s and 60 s, maintained as
+// samples arrive: a sample only updates the open 1 s cell, and a cell
+// that closes is merged into the open cell one level up, so the work per
+// sample is O(channels) whatever the number of levels. Cells are aligned
+// to `origin`; gaps in the stream simply leave cells out.
+//
+// Closed cells of levels `keepFrom` and up are kept in `cells`; finer
+// ones are only folded upwards (they can be rebuilt from the raw samples,
+// see fetch.h).
+//
+template <std::size_t C>
+struct SummaryPyramid {
+  typedef SummaryCell<C> Cell;
+
+  explicit SummaryPyramid(int keepFrom = LEVEL_10S) : _keepFrom(keepFrom)
+  {
+    reset(0);
+  }
+
+  // Drop everything; cells are aligned to `origin` (ms) from here
+  void reset(uint64_t origin)
+  {
+    _origin = origin;
+    for (int k = 0; k < NUM_LEVELS; k++) {
+      _open[k].n = 0;
+      cells[k].clear();
+    }
+  }
+
+  // One sample at `t` ms (no earlier than `origin` or the previous sample)
+  void add(const float *v, uint64_t t)
+  {
+    if (_open[0].n && t >= _open[0].t0 + levelSpans[0])
+      close(t);
+    if (!_open[0].n)
+      _open[0].start(align(t, 0));
+    _open[0].add(v);
+  }
+
+  // Close the open cells, e.g. at the end of a window
+  void finish() { close(UINT64_MAX); }
+
+  // The closed cells of the coarsest level merged into one
+  Cell total() const
+  {
+    const std::vector<Cell>& top = cells[NUM_LEVELS - 1];
+    Cell t;
+    t.start(top.empty() ? _origin : top.front().t0);
+    for (const Cell& c : top)
+      t.merge(c);
+    return t;
+  }
+
+  std::vector<Cell> cells[NUM_LEVELS]; // closed cells, oldest first
+
+private:
+  uint64_t align(uint64_t t, int level) const
+  {
+    return t - (t - _origin) % levelSpans[level];
+  }
+
+  // Close the open cells that end at or before `t`, finest first
+  void close(uint64_t t)
+  {
+    for (int k = 0; k < NUM_LEVELS; k++) {
+      Cell& c = _open[k];
+      if (!c.n || t < c.t0 + levelSpans[k])
+        return;
+      if (k + 1 < NUM_LEVELS) {
+        Cell& up = _open[k + 1];
+        if (!up.n)
+          up.start(align(c.t0, k + 1));
+        up.merge(c);
+      }
+      if (k >= _keepFrom)
+        cells[k].push_back(c);
+      c.n = 0;
+    }
+  }
+
+  int _keepFrom;
+  uint64_t _origin;
+  Cell _open[NUM_LEVELS];
+};
+
+//
+// Append `cell` of sensor `S` (see sensors.h) as
+// {"t":<ms>,"n":<samples>,"<S::axis(0)>":[min,max,mean,energy],...}
+//
+template <typename S>
+void appendCellJson(std::string& out, const SummaryCell<S::channels>& cell)
+{
+  out += "{\"t\":" + std::to_string(cell.t0) +
+         ",\"n\":" + std::to_string(cell.n);
+  for (std::size_t c = 0; c < S::channels; c++) {
+    out += ",\"";
+    out += S::axis(c);
+    out += "\":[" + std::to_string(cell.min[c]) +
+           "," + std::to_string(cell.max[c]) +
+           "," + std::to_string(cell.mean(c)) +
+           "," + std::to_string(cell.energy(c)) + "]";
+  }
+  out += "}";
+}
+
+#endif /* __PYRAMID_H__ */
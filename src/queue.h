@@ -1,55 +1,179 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
 #include <vector>
 #include <deque>
 #include <iostream>
 #include <atomic>
 #include <mutex>
 #include <memory>
+#include <chrono>
 #include <condition_variable>
 
-// Concurrent FIFO queue
-template <typename T>
+//
+// Concurrent FIFO queue with `P` priority classes. Class 0 is served
+// first; items within a class keep FIFO order.
+//
+// Two ways to stop consumers:
+//   forceDone()  dequeue returns nullptr right away, queued items stay
+//   drainDone()  dequeue keeps handing out queued items and returns
+//                nullptr once everything has been taken
+//
+// With a non-zero `capacity`, `enqueue` blocks while that many items are
+// queued, so a slow consumer holds back its producer (see pipeline.h).
+// Never give a capacity to a queue fed from the main loop.
+//
+template <typename T, std::size_t P = 1>
 struct Queue {
-  Queue() : _done(false) {};
+  explicit Queue(std::size_t capacity = 0)
+    : _done(false), _draining(false), _capacity(capacity) {};
 
   std::unique_ptr<T> dequeue() {
     std::unique_lock<std::mutex> lk(m);
-    bool done;
-    cv.wait(lk, [this, &done]() {
-      done = this->_done.load();
-      return !this->container.empty() || done;
+    cv.wait(lk, [this]() {
+      return !this->_empty() || this->_finished();
     });
 
-    if (done) {
+    if (_done.load() || _empty()) {
       lk.unlock();
       return nullptr;
     }
 
-    auto result = std::move(container.front());
-    container.pop_front();
+    auto result = _pop();
     lk.unlock();
     return result;
   }
 
-  void enqueue(std::unique_ptr<T> data) {
+  //
+  // Wait up to `max_wait` for the first item, then move every available
+  // item (up to `max_n`, highest priority first) into `out` under a single
+  // lock. Returns false once the queue is finished and nothing is left to
+  // hand out; an empty batch with `true` means the wait timed out.
+  //
+  template <typename Rep, typename Period>
+  bool dequeue_batch(std::vector<std::unique_ptr<T>>& out, std::size_t max_n,
+                     std::chrono::duration<Rep, Period> max_wait) {
+    std::unique_lock<std::mutex> lk(m);
+    cv.wait_for(lk, max_wait, [this]() {
+      return !this->_empty() || this->_finished();
+    });
+
+    if (_done.load())
+      return false;
+
+    std::size_t n = 0;
+    while (n < max_n && !_empty()) {
+      out.push_back(_pop());
+      n++;
+    }
+    return n > 0 || !_draining;
+  }
+
+  void enqueue(std::unique_ptr<T> data, std::size_t priority = 0) {
     std::unique_lock<std::mutex> lk(m);
-    container.push_back(std::move(data));
+    if (_capacity) {
+      cvSpace.wait(lk, [this]() {
+        return this->_size() < this->_capacity || this->_done.load();
+      });
+    }
+    container[priority < P ? priority : P - 1].push_back(std::move(data));
     lk.unlock();
-    cv.notify_all();
+    cv.notify_one();
+  }
+
+  //
+  // Take up to `max_n` items from the end consumers would reach last (the
+  // back of the lowest priority class first), e.g. to move them out of
+  // memory. Returns how many were taken; `out` gets them in FIFO order.
+  //
+  std::size_t steal(std::vector<std::unique_ptr<T>>& out, std::size_t max_n) {
+    std::vector<std::unique_ptr<T>> taken;
+    {
+      std::lock_guard<std::mutex> lk(m);
+      for (std::size_t p = P; p-- > 0 && taken.size() < max_n;) {
+        auto& c = container[p];
+        while (!c.empty() && taken.size() < max_n) {
+          taken.push_back(std::move(c.back()));
+          c.pop_back();
+        }
+      }
+    }
+    if (_capacity)
+      cvSpace.notify_all();
+    for (auto it = taken.rbegin(); it != taken.rend(); ++it)
+      out.push_back(std::move(*it));
+    return taken.size();
   }
 
   void forceDone() {
     _done.store(true);
+    std::lock_guard<std::mutex> lk(m);
+    cv.notify_all();
+    cvSpace.notify_all();
+  }
+
+  void drainDone() {
+    std::lock_guard<std::mutex> lk(m);
+    _draining = true;
     cv.notify_all();
   }
 
   void clear() {
-    container.clear();
+    std::lock_guard<std::mutex> lk(m);
+    for (auto& c : container)
+      c.clear();
     _done.store(false);
+    _draining = false;
     cv.notify_all();
+    cvSpace.notify_all();
+  }
+
+  std::size_t size() {
+    std::lock_guard<std::mutex> lk(m);
+    return _size();
   }
 
   std::mutex m;
   std::condition_variable cv;
+  std::condition_variable cvSpace; // bounded queues: an item was taken
   std::atomic<bool> _done;
-  std::deque<std::unique_ptr<T>> container;
+  bool _draining;
+  std::size_t _capacity; // 0: unbounded
+  std::deque<std::unique_ptr<T>> container[P];
+
+private:
+  // Helpers below expect `m` to be held
+  bool _empty() const {
+    for (auto& c : container) {
+      if (!c.empty())
+        return false;
+    }
+    return true;
+  }
+
+  std::size_t _size() const {
+    std::size_t n = 0;
+    for (auto& c : container)
+      n += c.size();
+    return n;
+  }
+
+  bool _finished() const {
+    return _done.load() || _draining;
+  }
+
+  std::unique_ptr<T> _pop() {
+    for (auto& c : container) {
+      if (!c.empty()) {
+        auto result = std::move(c.front());
+        c.pop_front();
+        if (_capacity)
+          cvSpace.notify_one();
+        return result;
+      }
+    }
+    return nullptr;
+  }
 };
+
+#endif /* __QUEUE_H__ */
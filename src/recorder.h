@@ -0,0 +1,354 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <dlog.h>
+
+#include "data.h"
+#include "archive.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "drunkare-debug"
+#endif
+
+enum RecordFormat {
+  RECORD_CSV,
+  RECORD_BINARY
+};
+
+struct RecorderOptions {
+  RecordFormat format = RECORD_CSV;
+  std::size_t rotateBytes = 16 * 1024 * 1024;
+  std::size_t maxFiles = 0;          // rotated files kept; 0 keeps all
+  std::size_t bufferBytes = 1024 * 1024;
+  std::size_t maxPending = 8 * 1024 * 1024;
+  double syncPeriod = 5.0;           // s
+};
+
+//
+// Local recorder of completed windows, for sessions without connectivity.
+//
+// `record` copies a window, in `Archive` record layout, into a pending
+// buffer and returns; a dedicated thread swaps that buffer out and writes
+// it through one large reusable write buffer, either as CSV rows
+// (`id,context,type,kind,` then the samples channel after channel, as
+// `Archive::exportCsv`) or as raw `Archive` records. Files are rotated by
+// size (`path` is the active file, full ones become `path.<n>`) and synced
+// at most once per `syncPeriod`, plus on rotation and `stop`.
+//
+// When the thread falls behind by more than `maxPending` bytes, `record`
+// blocks, like a bounded `Queue`. Failed writes (e.g. a full disk) lose
+// the data being written; they are counted and logged, not retried.
+//
+struct Recorder {
+  typedef RecorderOptions Options;
+
+  Recorder() : _fd(-1), _fileSize(0), _nextFile(1), _failing(false),
+               _running(false), _stopping(false), _records(0), _bytes(0),
+               _files(0), _syncs(0), _blocked(0), _writeErrors(0) {}
+
+  ~Recorder()
+  {
+    stop();
+    close();
+  }
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  bool open(const std::string& path, const Options& opt = Options())
+  {
+    std::lock_guard<std::mutex> lk(_fileM);
+    _path = path;
+    _opt = opt;
+    if (_opt.bufferBytes < 64 * 1024)
+      _opt.bufferBytes = 64 * 1024;
+    _out.resize(_opt.bufferBytes);
+
+    // Continue numbering after files rotated by an earlier run, past the
+    // highest suffix: pruning leaves the low ones missing
+    _nextFile = lastRotated() + 1;
+    return openActive();
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lk(_fileM);
+    if (_fd >= 0) {
+      fdatasync(_fd);
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  bool start()
+  {
+    if (_running)
+      return true;
+    _stopping = false;
+    if (pthread_create(&_thread, nullptr, run, this) != 0)
+      return false;
+    _running = true;
+    return true;
+  }
+
+  // Write everything recorded so far, sync, and stop the thread
+  void stop()
+  {
+    if (!_running)
+      return;
+    {
+      std::lock_guard<std::mutex> lk(_m);
+      _stopping = true;
+      _cvData.notify_one();
+    }
+    pthread_join(_thread, nullptr);
+    _running = false;
+  }
+
+  //
+  // Queue a copy of `measure` for writing. `M` is `MeasureBase` or
+  // anything `Archive::append` accepts. Returns false if the recorder
+  // isn't running.
+  //
+  template <typename M>
+  bool record(const M& measure)
+  {
+    Archive::RecordHeader hdr = Archive::headerOf(measure);
+    std::size_t column = sizeof(float) * hdr.numSamples;
+
+    std::unique_lock<std::mutex> lk(_m);
+    if (!_running || _stopping)
+      return false;
+    if (_pending.size() >= _opt.maxPending) {
+      _blocked++;
+      _cvSpace.wait(lk, [this]() {
+        return _pending.size() < _opt.maxPending || _stopping;
+      });
+      if (_stopping)
+        return false;
+    }
+
+    std::size_t off = _pending.size();
+    _pending.resize(off + sizeof(hdr) + column * hdr.channels);
+    memcpy(&_pending[off], &hdr, sizeof(hdr));
+    off += sizeof(hdr);
+    for (std::size_t c = 0; c < hdr.channels; c++, off += column)
+      memcpy(&_pending[off], measure._channel(c), column);
+    _records++;
+    _cvData.notify_one();
+    return true;
+  }
+
+  uint64_t records() const { return _records; }
+  uint64_t bytes() const { return _bytes; }     // written to files
+  uint64_t files() const { return _files; }     // rotations
+  uint64_t syncs() const { return _syncs; }
+  uint64_t blocked() const { return _blocked; } // `record` calls that waited
+  uint64_t writeErrors() const { return _writeErrors; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::string rotatedPath(std::size_t n) const
+  {
+    return _path + "." + std::to_string(n);
+  }
+
+  // Highest `n` of the existing `path.<n>` files, 0 if there are none
+  std::size_t lastRotated() const
+  {
+    std::size_t slash = _path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : _path.substr(0, slash);
+    std::string prefix = _path.substr(slash + 1) + "."; // npos + 1 == 0
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+      return 0;
+    std::size_t last = 0;
+    while (struct dirent *e = readdir(d)) {
+      if (strncmp(e->d_name, prefix.c_str(), prefix.size()) != 0)
+        continue;
+      const char *digits = e->d_name + prefix.size();
+      char *end;
+      unsigned long n = strtoul(digits, &end, 10);
+      if (*digits >= '0' && *digits <= '9' && *end == '\0' && n > last)
+        last = n;
+    }
+    closedir(d);
+    return last;
+  }
+
+  bool openActive()
+  {
+    _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (_fd < 0)
+      return false;
+    struct stat st;
+    _fileSize = fstat(_fd, &st) == 0 ? st.st_size : 0;
+    return true;
+  }
+
+  static void *run(void *data)
+  {
+    Recorder *self = (Recorder *)data;
+    std::vector<char> batch;
+    Clock::time_point lastSync = Clock::now();
+    bool dirty = false;
+
+    for (;;) {
+      bool stopping;
+      {
+        std::unique_lock<std::mutex> lk(self->_m);
+        self->_cvData.wait_for(lk, std::chrono::duration<double>(
+                                       self->_opt.syncPeriod), [self]() {
+          return !self->_pending.empty() || self->_stopping;
+        });
+        batch.swap(self->_pending); // `_pending` keeps `batch`'s capacity
+        stopping = self->_stopping;
+        self->_cvSpace.notify_all();
+      }
+
+      if (!batch.empty()) {
+        std::lock_guard<std::mutex> lk(self->_fileM);
+        self->writeBatch(batch);
+        batch.clear();
+        dirty = true;
+      }
+
+      std::chrono::duration<double> since = Clock::now() - lastSync;
+      if (dirty && (stopping || since.count() >= self->_opt.syncPeriod)) {
+        std::lock_guard<std::mutex> lk(self->_fileM);
+        if (self->_fd >= 0 && fdatasync(self->_fd) == 0)
+          self->_syncs++;
+        lastSync = Clock::now();
+        dirty = false;
+      }
+      if (stopping)
+        break;
+    }
+    return nullptr;
+  }
+
+  // Format `batch` (records in `Archive` layout) through `_out`
+  void writeBatch(const std::vector<char>& batch)
+  {
+    std::size_t used = 0;
+    std::size_t off = 0;
+    while (off + sizeof(Archive::RecordHeader) <= batch.size()) {
+      Archive::RecordHeader hdr;
+      memcpy(&hdr, &batch[off], sizeof(hdr));
+      const float *columns = (const float *)&batch[off + sizeof(hdr)];
+      std::size_t recordBytes = sizeof(hdr) +
+          sizeof(float) * hdr.channels * hdr.numSamples;
+      std::size_t size = _opt.format == RECORD_CSV
+          ? Archive::csvBytes(hdr)
+          : recordBytes; // upper bound of the formatted record
+
+      if (used > 0 && (used + size > _out.size() ||
+                       _fileSize + used + size > _opt.rotateBytes)) {
+        flush(used);
+        used = 0;
+      }
+      if (_fileSize > 0 && _fileSize + size > _opt.rotateBytes)
+        rotate();
+      if (size > _out.size())
+        _out.resize(size);
+
+      char *p = &_out[used];
+      if (_opt.format == RECORD_CSV) {
+        p = Archive::formatCsv(p, hdr, columns);
+      } else {
+        memcpy(p, &batch[off], recordBytes);
+        p += recordBytes;
+      }
+      used = p - &_out[0];
+      off += recordBytes;
+    }
+    if (used > 0)
+      flush(used);
+  }
+
+  void flush(std::size_t len)
+  {
+    if (_fd < 0)
+      return;
+    const char *p = _out.data();
+    while (len > 0) {
+      ssize_t n = ::write(_fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        // Disk full or gone; the recorder is best effort. Log once per
+        // stretch of failures.
+        _writeErrors++;
+        if (!_failing) {
+          dlog_print(DLOG_ERROR, LOG_TAG, "[-] recorder: write failed: %s",
+                     strerror(errno));
+        }
+        _failing = true;
+        return;
+      }
+      p += n;
+      len -= n;
+      _fileSize += n;
+      _bytes += n;
+    }
+    _failing = false;
+  }
+
+  // Sync and seal the active file as `path.<n>`, then start a new one
+  void rotate()
+  {
+    if (_fd >= 0) {
+      if (fdatasync(_fd) == 0)
+        _syncs++;
+      ::close(_fd);
+      _fd = -1;
+    }
+    ::rename(_path.c_str(), rotatedPath(_nextFile).c_str());
+    if (_opt.maxFiles > 0 && _nextFile > _opt.maxFiles)
+      ::unlink(rotatedPath(_nextFile - _opt.maxFiles).c_str());
+    _nextFile++;
+    _files++;
+    openActive();
+  }
+
+  std::mutex _m; // `_pending`, `_stopping`
+  std::condition_variable _cvData, _cvSpace;
+  std::vector<char> _pending;
+
+  std::mutex _fileM; // the active file, for `open`/`close` vs. the thread
+  std::string _path;
+  Options _opt;
+  std::vector<char> _out;
+  int _fd;
+  std::size_t _fileSize;
+  std::size_t _nextFile;
+  bool _failing; // the last write failed
+
+  pthread_t _thread;
+  bool _running;
+  bool _stopping;
+
+  std::atomic<uint64_t> _records, _bytes, _files, _syncs, _blocked;
+  std::atomic<uint64_t> _writeErrors;
+};
+
+#endif /* __RECORDER_H__ */
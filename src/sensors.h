@@ -0,0 +1,101 @@
+#ifndef __SENSORS_H__
+#define __SENSORS_H__
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+#include <sensor.h>
+
+//
+// Compile-time description of the sensors we sample.
+//
+// A descriptor provides
+//   channels     number of values per event we keep
+//   devicePeriod ms between sensor events (listener interval)
+//   storedPeriod ms between samples kept in a window; a multiple of
+//                `devicePeriod`, the events in between are dropped
+//   native       Tizen sensor type
+//   name()       key of the sensor object in the JSON upload
+//   axis(c)      key of channel `c` inside that object
+//
+// The app lists its descriptors once in a `SensorList`; per-sensor
+// storage, listener callbacks and serializers are generated from that list
+// (see `forEachSensor`), so adding a sensor means adding a descriptor and
+// appending it to the list.
+//
+struct Accelerometer {
+  static const std::size_t channels = 3;
+  static const int devicePeriod = 10; // 100 Hz
+  static const int storedPeriod = 40; // 25 Hz
+  static const sensor_type_e native = SENSOR_ACCELEROMETER;
+  static const char *name() { return "accel"; }
+  static const char *axis(std::size_t c)
+  {
+    static const char *const axes[] = {"x", "y", "z"};
+    return axes[c];
+  }
+};
+
+struct Gyroscope {
+  static const std::size_t channels = 3;
+  static const int devicePeriod = 20; // 50 Hz
+  static const int storedPeriod = 20; // 50 Hz
+  static const sensor_type_e native = SENSOR_GYROSCOPE;
+  static const char *name() { return "gyro"; }
+  static const char *axis(std::size_t c)
+  {
+    static const char *const axes[] = {"x", "y", "z"};
+    return axes[c];
+  }
+};
+
+struct HeartRate {
+  static const std::size_t channels = 1;
+  static const int devicePeriod = 1000; // 1 Hz
+  static const int storedPeriod = 1000; // 1 Hz
+  static const sensor_type_e native = SENSOR_HRM;
+  static const char *name() { return "hrm"; }
+  static const char *axis(std::size_t) { return "bpm"; }
+};
+
+template <typename... S>
+struct SensorList {
+  static const std::size_t size = sizeof...(S);
+
+  // `std::tuple<F<S>...>`, e.g. one window deque per sensor
+  template <template <typename> class F>
+  using map = std::tuple<F<S>...>;
+};
+
+// The `I`-th descriptor of a `SensorList`
+template <std::size_t I, typename List>
+struct SensorAtImpl;
+
+template <std::size_t I, typename... S>
+struct SensorAtImpl<I, SensorList<S...>> {
+  typedef typename std::tuple_element<I, std::tuple<S...>>::type type;
+};
+
+template <std::size_t I, typename List>
+using SensorAt = typename SensorAtImpl<I, List>::type;
+
+template <typename F, std::size_t... I>
+inline void forEachSensorImpl(F&& f, std::index_sequence<I...>)
+{
+  (f(std::integral_constant<std::size_t, I>()), ...);
+}
+
+//
+// Call `f(std::integral_constant<std::size_t, I>())` for every sensor
+// index of `List`. The index is a constant expression inside `f`, so it can
+// pick `SensorAt<I, List>`, `std::get<I>` or `sensorCb<I>` statically.
+//
+template <typename List, typename F>
+inline void forEachSensor(F&& f)
+{
+  forEachSensorImpl(f, std::make_index_sequence<List::size>());
+}
+
+#endif /* __SENSORS_H__ */
@@ -0,0 +1,430 @@
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "data.h"
+#include "queue.h"
+#include "archive.h"
+
+//
+// Append-only file of windows moved out of memory.
+//
+// The file starts with a `FileHeader` holding the read offset, then each
+// record is a `SpillHeader` followed by the window in `Archive` record
+// layout (`Archive::RecordHeader` plus channel-major floats). Records are
+// read back in the order they were written, and the read offset is saved
+// after every `read`, so the file survives a restart: windows spilled
+// before the OS killed us are picked up by the next run, and those
+// already reloaded are not reloaded again. Once everything has been read
+// the file is truncated; under sustained pressure, when the consumed
+// prefix passes `kCompactBytes` and half the file, the unread records are
+// copied to a new file that replaces it, so the file never keeps more
+// than about twice what is still spilled.
+//
+struct SpillFile {
+  static const uint32_t kMagic = 0x4c50534b; // "KSPL"
+  static const std::size_t kCompactBytes = 1024 * 1024;
+
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t _pad;
+    uint64_t readOff; // of the first unread record
+  };
+
+  struct SpillHeader {
+    int32_t kind;   // MEASURE_WINDOW, MEASURE_EVENT or MEASURE_IDLE
+    int32_t events;
+    int32_t userId;
+    int32_t profile;
+  };
+
+  SpillFile() : _fd(-1), _readOff(0), _size(0), _records(0) {}
+  ~SpillFile() { close(); }
+
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  bool open(const std::string& path)
+  {
+    std::lock_guard<std::mutex> lk(m);
+    _path = path;
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd < 0)
+      return false;
+    struct stat st;
+    _size = fstat(_fd, &st) == 0 ? st.st_size : 0;
+
+    // Anything without a valid header (e.g. a file of an older version)
+    // starts over empty
+    FileHeader fh;
+    if (!readAt(&fh, sizeof(fh), 0) || fh.magic != kMagic ||
+        fh.readOff < sizeof(fh) || fh.readOff > _size) {
+      return reset();
+    }
+    _readOff = fh.readOff;
+
+    // Records behind a tail torn by a kill would be unreachable: cut it
+    std::size_t end = _readOff;
+    _records = countRecords(end);
+    if (end < _size && ftruncate(_fd, end) == 0)
+      _size = end;
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  bool write(const MeasureBase& measure)
+  {
+    std::lock_guard<std::mutex> lk(m);
+    if (_fd < 0)
+      return false;
+
+    SpillHeader sh = {measure._kind, measure._events, measure._userId,
+                      measure._profile};
+    Archive::RecordHeader hdr = Archive::headerOf(measure);
+
+    // One write per record, so a kill leaves at most a torn tail
+    std::string buf;
+    buf.reserve(sizeof(sh) + sizeof(hdr) +
+                sizeof(float) * hdr.channels * hdr.numSamples);
+    buf.append((const char *)&sh, sizeof(sh));
+    buf.append((const char *)&hdr, sizeof(hdr));
+    for (std::size_t c = 0; c < hdr.channels; c++) {
+      buf.append((const char *)measure._channel(c),
+                 sizeof(float) * hdr.numSamples);
+    }
+    if (!writeAt(_fd, buf.data(), buf.size(), _size))
+      return false;
+    _size += buf.size();
+    _records++;
+    return true;
+  }
+
+  //
+  // Read up to `max_n` records, oldest first, and hand each to
+  // `fn(const SpillHeader&, const Archive::RecordHeader&, const float *columns)`.
+  // Returns the number of records read.
+  //
+  template <typename F>
+  std::size_t read(std::size_t max_n, F fn)
+  {
+    std::lock_guard<std::mutex> lk(m);
+    std::size_t n = 0;
+    std::size_t start = _readOff;
+    std::vector<float> columns;
+    while (n < max_n && _fd >= 0 && _readOff < _size) {
+      SpillHeader sh;
+      Archive::RecordHeader hdr;
+      if (!readAt(&sh, sizeof(sh), _readOff) ||
+          !readAt(&hdr, sizeof(hdr), _readOff + sizeof(sh)) ||
+          hdr.magic != Archive::kMagic) {
+        // Torn or foreign tail: drop it
+        _readOff = _size;
+        break;
+      }
+      columns.resize((std::size_t)hdr.channels * hdr.numSamples);
+      if (!readAt(columns.data(), sizeof(float) * columns.size(),
+                  _readOff + sizeof(sh) + sizeof(hdr))) {
+        _readOff = _size;
+        break;
+      }
+      _readOff += sizeof(sh) + sizeof(hdr) + sizeof(float) * columns.size();
+      _records--;
+      fn(sh, hdr, (const float *)columns.data());
+      n++;
+    }
+    if (_fd < 0 || _readOff == start)
+      return n;
+    if (_readOff >= _size)
+      reset();
+    else if (_readOff >= kCompactBytes &&
+             _readOff - sizeof(FileHeader) >= _size - _readOff)
+      compact();
+    else
+      saveReadOff();
+    return n;
+  }
+
+  std::size_t records()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    return _records;
+  }
+
+  std::size_t bytes()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    return _size - _readOff;
+  }
+
+private:
+  static bool writeAt(int fd, const void *buf, std::size_t len,
+                      std::size_t off)
+  {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+      ssize_t n = pwrite(fd, p, len, off);
+      if (n < 0)
+        return false;
+      p += n;
+      off += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool readAt(void *buf, std::size_t len, std::size_t off)
+  {
+    if (off + len > _size)
+      return false;
+    char *p = (char *)buf;
+    while (len > 0) {
+      ssize_t n = pread(_fd, p, len, off);
+      if (n <= 0)
+        return false;
+      p += n;
+      off += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  // Records from `end` on; `end` is left past the last complete one
+  std::size_t countRecords(std::size_t& end)
+  {
+    std::size_t n = 0;
+    SpillHeader sh;
+    Archive::RecordHeader hdr;
+    while (readAt(&sh, sizeof(sh), end) &&
+           readAt(&hdr, sizeof(hdr), end + sizeof(sh)) &&
+           hdr.magic == Archive::kMagic) {
+      std::size_t next = end + sizeof(sh) + sizeof(hdr) +
+                         sizeof(float) * hdr.channels * hdr.numSamples;
+      if (next > _size)
+        break;
+      end = next;
+      n++;
+    }
+    return n;
+  }
+
+  void saveReadOff()
+  {
+    FileHeader fh = {kMagic, 0, _readOff};
+    writeAt(_fd, &fh, sizeof(fh), 0);
+  }
+
+  // Empty the file down to its header
+  bool reset()
+  {
+    _readOff = _size = sizeof(FileHeader);
+    _records = 0;
+    FileHeader fh = {kMagic, 0, _readOff};
+    return ftruncate(_fd, 0) == 0 && writeAt(_fd, &fh, sizeof(fh), 0);
+  }
+
+  //
+  // Replace the file by one holding only the unread records. The new file
+  // is complete before it is renamed over the old one, so a kill leaves
+  // either of them intact. On failure the old file simply stays.
+  //
+  void compact()
+  {
+    std::string tmp = _path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      saveReadOff();
+      return;
+    }
+    FileHeader fh = {kMagic, 0, sizeof(FileHeader)};
+    bool ok = writeAt(fd, &fh, sizeof(fh), 0);
+    char buf[64 * 1024];
+    std::size_t out = sizeof(fh);
+    for (std::size_t off = _readOff; ok && off < _size;) {
+      std::size_t len = std::min(sizeof(buf), _size - off);
+      ok = readAt(buf, len, off) && writeAt(fd, buf, len, out);
+      off += len;
+      out += len;
+    }
+    if (!ok || rename(tmp.c_str(), _path.c_str()) < 0) {
+      ::close(fd);
+      unlink(tmp.c_str());
+      saveReadOff();
+      return;
+    }
+    ::close(_fd);
+    _fd = fd;
+    _size = out;
+    _readOff = sizeof(fh);
+  }
+
+  std::mutex m;
+  std::string _path;
+  int _fd;
+  std::size_t _readOff;
+  std::size_t _size;
+  std::size_t _records;
+};
+
+//
+// Keeps the memory held by windows (queued, being filled or being
+// serialized) under a budget.
+//
+// Owners report every window they create or free through `held`. When
+// the total goes over `budget`, or while the OS reports memory pressure,
+// `spill` moves queued windows, least urgent first, to a `SpillFile`.
+// Once pressure has cleared, `reload` brings them back a few at a time,
+// only as the queue empties, so the spill never turns into a burst.
+//
+// `make` recreates a window from a spilled record; it returns nullptr for
+// records it doesn't know (e.g. a sensor that was removed).
+//
+struct MemoryGovernor {
+  typedef std::function<std::unique_ptr<MeasureBase>(
+      const Archive::RecordHeader&, const float *columns, int kind)> Factory;
+
+  MemoryGovernor() : _budget(0), _bytes(0), _pressure(false) {}
+
+  bool open(const std::string& path, std::size_t budget, Factory make)
+  {
+    _budget = budget;
+    _make = make;
+    return _spill.open(path);
+  }
+
+  void close() { _spill.close(); }
+
+  // `delta` bytes of windows were allocated (> 0) or freed (< 0)
+  void held(std::ptrdiff_t delta) { _bytes += delta; }
+
+  std::size_t bytes() const
+  {
+    std::ptrdiff_t b = _bytes;
+    return b > 0 ? b : 0;
+  }
+  std::size_t budget() const { return _budget; }
+  bool overBudget() const { return bytes() > _budget; }
+
+  void setPressure(bool pressure) { _pressure = pressure; }
+  bool underPressure() const { return _pressure; }
+
+  std::size_t spilledRecords() { return _spill.records(); }
+  std::size_t spilledBytes() { return _spill.bytes(); }
+
+  //
+  // Move queued windows to disk until at most `target` bytes are held or
+  // the queue is empty. Returns the number of windows spilled.
+  //
+  template <std::size_t P>
+  std::size_t spill(Queue<MeasureBase, P>& queue, std::size_t target)
+  {
+    std::size_t n = 0;
+    std::vector<std::unique_ptr<MeasureBase>> taken;
+    while (bytes() > target) {
+      taken.clear();
+      if (!queue.steal(taken, 8))
+        break;
+      for (std::size_t i = 0; i < taken.size(); i++) {
+        if (!_spill.write(*taken[i])) {
+          // Disk refused: put the rest back rather than lose it
+          for (; i < taken.size(); i++)
+            queue.enqueue(std::move(taken[i]), P - 1);
+          return n;
+        }
+        held(-(std::ptrdiff_t)taken[i]->_bytes());
+        taken[i].reset();
+        n++;
+      }
+    }
+    return n;
+  }
+
+  //
+  // Bring back up to `max_n` spilled windows into `queue` at `priority`,
+  // unless under pressure or the budget would be exceeded. Returns the
+  // number of windows reloaded.
+  //
+  template <std::size_t P>
+  std::size_t reload(Queue<MeasureBase, P>& queue, std::size_t max_n,
+                     std::size_t priority)
+  {
+    if (_pressure)
+      return 0;
+    std::size_t n = 0;
+    while (n < max_n && bytes() < _budget / 2 && _spill.records() > 0) {
+      std::size_t got = _spill.read(1,
+          [&](const SpillFile::SpillHeader& sh,
+              const Archive::RecordHeader& hdr, const float *columns) {
+        std::unique_ptr<MeasureBase> m = _make(hdr, columns, sh.kind);
+        if (!m)
+          return;
+        m->_events = sh.events;
+        m->_userId = sh.userId;
+        m->_profile = sh.profile;
+        held(m->_bytes());
+        queue.enqueue(std::move(m), priority);
+        n++;
+      });
+      if (!got)
+        break;
+    }
+    return n;
+  }
+
+private:
+  std::size_t _budget;
+  std::atomic<std::ptrdiff_t> _bytes;
+  std::atomic<bool> _pressure;
+  Factory _make;
+  SpillFile _spill;
+};
+
+//
+// Rebuild a `Measure` `M` from a spilled record, for use in a `Factory`.
+// Returns nullptr if the record doesn't match `M`'s layout.
+//
+template <typename M>
+inline std::unique_ptr<MeasureBase> unspill(const Archive::RecordHeader& hdr,
+                                            const float *columns, int kind)
+{
+  int period = hdr.samplingPeriod;
+  if (hdr.channels != M::C || period < M::_samplingPeriod ||
+      period % M::_samplingPeriod)
+    return nullptr;
+
+  std::unique_ptr<M> m(new M(hdr.id, hdr.sensor, hdr.context, hdr.timestamp,
+                             0, period, period));
+  if (hdr.numSamples > m->_capacity)
+    return nullptr;
+  m->_kind = kind;
+  float v[M::C];
+  for (std::size_t j = 0; j < hdr.numSamples; j++) {
+    for (std::size_t c = 0; c < M::C; c++)
+      v[c] = columns[c * hdr.numSamples + j];
+    m->push(v);
+  }
+  return std::unique_ptr<MeasureBase>(std::move(m));
+}
+
+#endif /* __SPILL_H__ */
@@ -0,0 +1,426 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <curl/curl.h>
+
+#include "loop.h"
+#include "http.h"
+#include "format.h"
+
+//
+// Live streaming of stored samples, for a server that must react within
+// a second (falls, stumbles) rather than after a 60 s window.
+//
+// The app cuts each sensor's stored samples into short chunks
+// (`StreamChunker`) and hands them to a `StreamClient`, which keeps one
+// long-lived chunked POST open and writes every chunk as one
+// newline-delimited JSON line:
+//
+//   {"seq":N,"user_id":U,"type":T,"period":ms,"t0_us":..,"t1_us":..,
+//    "<S::name()>":{"<S::axis(0)>":[...],...}}
+//
+// `seq` numbers chunks across sensors. `t0_us`/`t1_us` are the wall clock
+// times of the first and last sample, so the server can measure how old
+// a sample is when it arrives. Windows still go through the normal upload
+// path; the stream is best effort on top.
+//
+
+//
+// Collects stored samples of sensor `S` until they span `chunkMs`
+//
+template <typename S>
+struct StreamChunker {
+  static const std::size_t C = S::channels;
+
+  int chunkMs = 250;
+
+  StreamChunker() : _t0(0), _t1(0) {}
+
+  void reset()
+  {
+    for (std::size_t c = 0; c < C; c++)
+      _samples[c].clear();
+  }
+
+  bool empty() const { return _samples[0].empty(); }
+
+  // Add a sample taken at `us` (wall clock); true once a chunk is due
+  bool add(const float *values, uint64_t us)
+  {
+    if (empty())
+      _t0 = us;
+    _t1 = us;
+    for (std::size_t c = 0; c < C; c++)
+      _samples[c].push_back(values[c]);
+    return _t1 - _t0 >= (uint64_t)chunkMs * 1000;
+  }
+
+  // The chunk's fields after "seq"/"user_id"; starts a new chunk
+  std::string take(int type, int period)
+  {
+    std::size_t n = _samples[0].size();
+    std::string out;
+    out.resize(128 + 24 * C * n);
+    char *p = &out[0];
+    p += sprintf(p, "\"type\":%d,\"period\":%d,\"t0_us\":%llu,"
+                 "\"t1_us\":%llu,\"%s\":{", type, period,
+                 (unsigned long long)_t0, (unsigned long long)_t1, S::name());
+    for (std::size_t c = 0; c < C; c++) {
+      p += sprintf(p, "%s\"%s\":[", c ? "," : "", S::axis(c));
+      for (std::size_t j = 0; j < n; j++) {
+        if (j)
+          *p++ = ',';
+        p = formatFloat(p, _samples[c][j]);
+      }
+      *p++ = ']';
+    }
+    *p++ = '}';
+    out.resize(p - &out[0]);
+    reset();
+    return out;
+  }
+
+private:
+  std::vector<float> _samples[C];
+  uint64_t _t0, _t1;
+};
+
+struct StreamMetrics {
+  uint64_t chunks = 0;     // handed to `send`
+  uint64_t bytes = 0;      // written to the connection
+  uint64_t resent = 0;     // chunks sent again after a reconnect
+  uint64_t dropped = 0;    // chunks never sent (buffer full)
+  uint64_t connects = 0;
+  uint64_t failures = 0;
+};
+
+//
+// One long-lived chunked POST to `url`, on a `Loop`.
+//
+// Chunks are buffered until the server has confirmed them: the body of a
+// stream ends with {"next_seq":N}, and before streaming again after a
+// failure the client asks `url`/resume for it. Chunks from N on are then
+// sent again, so a reconnect loses nothing that still fits in
+// `maxBuffered` bytes. The stream is ended and reopened every
+// `rotatePeriod` s so confirmed chunks don't pile up.
+//
+// Everything runs on the loop thread. `curl_global_init` must have been
+// called.
+//
+struct StreamClient {
+  StreamMetrics metrics;
+
+  StreamClient(Loop& loop, const std::string& url, int userId,
+               uint64_t session, std::size_t maxBuffered = 256 * 1024,
+               double rotatePeriod = 300)
+    : _loop(loop), _url(url), _userId(userId), _session(session),
+      _maxBuffered(maxBuffered), _rotatePeriod(rotatePeriod),
+      _state(IDLE), _multi(loop, progressCb, this), _easy(nullptr),
+      _headers(nullptr), _timer(nullptr), _backoff(0), _nextSeq(0),
+      _sentEnd(0), _buffered(0), _sendIdx(0), _sendOff(0), _paused(false),
+      _finishing(false), _stopping(false) {}
+
+  ~StreamClient()
+  {
+    cleanupEasy();
+    if (_timer)
+      _loop.delTimer(_timer);
+  }
+
+  StreamClient(const StreamClient&) = delete;
+  StreamClient& operator=(const StreamClient&) = delete;
+
+  // Connect, resuming wherever the server is for this session
+  void start()
+  {
+    _stopping = false;
+    if (_state == IDLE)
+      resume();
+  }
+
+  // End the current stream once what is buffered has been sent
+  void stop()
+  {
+    _stopping = true;
+    if (_state == STREAMING) {
+      _finishing = true;
+      wake();
+    } else if (_state == BACKOFF) {
+      _loop.delTimer(_timer);
+      _timer = nullptr;
+      _state = IDLE;
+    }
+  }
+
+  bool connected() const { return _state == STREAMING; }
+
+  // Queue one chunk (`StreamChunker::take`)
+  void send(const std::string& fields)
+  {
+    char head[64];
+    snprintf(head, sizeof(head), "{\"seq\":%llu,\"user_id\":%d,",
+             (unsigned long long)_nextSeq, _userId);
+    Chunk chunk;
+    chunk.seq = _nextSeq++;
+    chunk.line.reserve(strlen(head) + fields.size() + 2);
+    chunk.line += head;
+    chunk.line += fields;
+    chunk.line += "}\n";
+    _buffered += chunk.line.size();
+    _chunks.push_back(std::move(chunk));
+    metrics.chunks++;
+
+    // Forget the oldest chunks, but never one half way out
+    while (_buffered > _maxBuffered && !(_sendIdx == 0 && _sendOff > 0) &&
+           _chunks.size() > 1) {
+      if (_sendIdx > 0)
+        _sendIdx--;
+      else
+        metrics.dropped++;
+      _buffered -= _chunks.front().line.size();
+      _chunks.pop_front();
+    }
+    wake();
+  }
+
+private:
+  enum State { IDLE, RESUMING, STREAMING, BACKOFF };
+
+  struct Chunk {
+    uint64_t seq;
+    std::string line;
+  };
+
+  std::string query() const
+  {
+    return "?user_id=" + std::to_string(_userId) +
+           "&session=" + std::to_string(_session);
+  }
+
+  // GET url/resume: where the server is, then stream from there
+  void resume()
+  {
+    _state = RESUMING;
+    _response.clear();
+    _easy = curl_easy_init();
+    std::string url = _url + "/resume" + query();
+    curl_easy_setopt(_easy, CURLOPT_URL, url.c_str());
+    setCommon();
+    curl_multi_add_handle(_multi.handle, _easy);
+  }
+
+  void stream()
+  {
+    _state = STREAMING;
+    _response.clear();
+    _sendIdx = _sendOff = 0;
+    _paused = _finishing = false;
+    metrics.connects++;
+
+    _headers = curl_slist_append(_headers, "Content-Type: application/x-ndjson");
+    _headers = curl_slist_append(_headers, "Transfer-Encoding: chunked");
+    _headers = curl_slist_append(_headers, "Expect:");
+    _easy = curl_easy_init();
+    std::string url = _url + query();
+    curl_easy_setopt(_easy, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(_easy, CURLOPT_POST, 1L);
+    curl_easy_setopt(_easy, CURLOPT_HTTPHEADER, _headers);
+    curl_easy_setopt(_easy, CURLOPT_READFUNCTION, readCb);
+    curl_easy_setopt(_easy, CURLOPT_READDATA, this);
+    curl_easy_setopt(_easy, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(_easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    setCommon();
+    curl_easy_setopt(_easy, CURLOPT_TIMEOUT, 0L);
+    curl_multi_add_handle(_multi.handle, _easy);
+
+    if (_rotatePeriod > 0)
+      _timer = _loop.addTimer(_rotatePeriod, rotateCb, this);
+  }
+
+  void setCommon()
+  {
+    curl_easy_setopt(_easy, CURLOPT_WRITEFUNCTION, writeCb);
+    curl_easy_setopt(_easy, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(_easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(_easy, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(_easy, CURLOPT_TIMEOUT, 10L);
+  }
+
+  void cleanupEasy()
+  {
+    if (_easy) {
+      curl_multi_remove_handle(_multi.handle, _easy);
+      curl_easy_cleanup(_easy);
+      _easy = nullptr;
+    }
+    curl_slist_free_all(_headers);
+    _headers = nullptr;
+  }
+
+  // Let a paused upload pick up new chunks (or its end)
+  void wake()
+  {
+    if (_state == STREAMING && _paused) {
+      _paused = false;
+      curl_easy_pause(_easy, CURLPAUSE_CONT);
+    }
+  }
+
+  // Drop chunks the server has; the rest go out again on the next stream
+  void confirmed(uint64_t nextSeq)
+  {
+    while (!_chunks.empty() && _chunks.front().seq < nextSeq) {
+      _buffered -= _chunks.front().line.size();
+      _chunks.pop_front();
+    }
+  }
+
+  bool parseNextSeq(uint64_t& seq) const
+  {
+    const char *p = strstr(_response.c_str(), "\"next_seq\":");
+    if (!p)
+      return false;
+    seq = strtoull(p + strlen("\"next_seq\":"), nullptr, 10);
+    return true;
+  }
+
+  void done(CURLcode code)
+  {
+    long status = 0;
+    curl_easy_getinfo(_easy, CURLINFO_RESPONSE_CODE, &status);
+    cleanupEasy();
+    if (_timer && _state == STREAMING) {
+      _loop.delTimer(_timer);
+      _timer = nullptr;
+    }
+
+    uint64_t seq;
+    bool ok = code == CURLE_OK && status == 200 && parseNextSeq(seq);
+    if (!ok) {
+      metrics.failures++;
+      if (_stopping) {
+        _state = IDLE; // what is left goes out on the next `start`
+        return;
+      }
+      double delay = _backoff = _backoff > 0 ? _backoff * 2 : 0.1;
+      if (_backoff > 30)
+        _backoff = delay = 30;
+      _state = BACKOFF;
+      _timer = _loop.addTimer(delay, backoffCb, this);
+      return;
+    }
+    _backoff = 0;
+    confirmed(seq);
+    if (_stopping && _chunks.empty()) {
+      _state = IDLE;
+      return;
+    }
+    stream();
+    _finishing = _stopping;
+  }
+
+  static size_t readCb(char *buf, size_t size, size_t nitems, void *data)
+  {
+    StreamClient *self = (StreamClient *)data;
+    std::size_t room = size * nitems, n = 0;
+    while (n < room && self->_sendIdx < self->_chunks.size()) {
+      Chunk& chunk = self->_chunks[self->_sendIdx];
+      if (self->_sendOff == 0 && chunk.seq < self->_sentEnd)
+        self->metrics.resent++;
+      std::size_t len = std::min(room - n, chunk.line.size() - self->_sendOff);
+      memcpy(buf + n, chunk.line.data() + self->_sendOff, len);
+      n += len;
+      self->_sendOff += len;
+      if (self->_sendOff == chunk.line.size()) {
+        self->_sentEnd = std::max(self->_sentEnd, chunk.seq + 1);
+        self->_sendIdx++;
+        self->_sendOff = 0;
+      }
+    }
+    self->metrics.bytes += n;
+    // Once finishing, the body ends as soon as everything is out
+    if (n > 0 || self->_finishing)
+      return n;
+    self->_paused = true;
+    return CURL_READFUNC_PAUSE;
+  }
+
+  static size_t writeCb(char *ptr, size_t size, size_t nmemb, void *data)
+  {
+    StreamClient *self = (StreamClient *)data;
+    self->_response.append(ptr, size * nmemb);
+    return size * nmemb;
+  }
+
+  static bool rotateCb(void *data)
+  {
+    StreamClient *self = (StreamClient *)data;
+    self->_timer = nullptr;
+    self->_finishing = true;
+    self->wake();
+    return false;
+  }
+
+  static bool backoffCb(void *data)
+  {
+    StreamClient *self = (StreamClient *)data;
+    self->_timer = nullptr;
+    self->resume();
+    return false;
+  }
+
+  void checkDone()
+  {
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(_multi.handle, &left))) {
+      if (msg->msg == CURLMSG_DONE && msg->easy_handle == _easy) {
+        done(msg->data.result);
+        return; // `done` may have replaced `_easy`
+      }
+    }
+  }
+
+  // `CurlMulti` progress
+  static void progressCb(void *data)
+  {
+    ((StreamClient *)data)->checkDone();
+  }
+
+  Loop& _loop;
+  std::string _url;
+  int _userId;
+  uint64_t _session;
+  std::size_t _maxBuffered;
+  double _rotatePeriod;
+
+  State _state;
+  CurlMulti _multi;
+  CURL *_easy;
+  struct curl_slist *_headers;
+  void *_timer; // rotation or backoff
+  double _backoff;
+  std::string _response;
+
+  std::deque<Chunk> _chunks; // sent or not, until confirmed
+  uint64_t _nextSeq;
+  uint64_t _sentEnd;  // seq after the last one ever written
+  std::size_t _buffered;
+  std::size_t _sendIdx; // next chunk of `_chunks` to write
+  std::size_t _sendOff; // bytes of it already written
+  bool _paused;
+  bool _finishing;
+  bool _stopping;
+};
+
+#endif /* __STREAM_H__ */
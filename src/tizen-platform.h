@@ -0,0 +1,283 @@
+#ifndef __TIZEN_PLATFORM_H__
+#define __TIZEN_PLATFORM_H__
+
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+
+#include <app_common.h>
+#include <sensor.h>
+#include <locations.h>
+#include <device/power.h>
+#include <device/battery.h>
+#include <device/callback.h>
+#include <dlog.h>
+
+#include "platform.h"
+#include "sensors.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "drunkare-debug"
+#endif
+
+//
+// `Platform` of the watch: sensor listeners for the sensors of
+// `Sensors`, a location manager (recreated when the positioning method
+// changes), the CPU power lock and the battery device callbacks.
+// Listeners and the location manager are created on first use (the
+// latter only works once the location privilege is granted).
+//
+template <typename Sensors>
+struct TizenPlatform : Platform {
+  TizenPlatform() : _location(nullptr), _method(LOCATION_HYBRID),
+                    _locationRunning(false),
+                    _locationCb(nullptr), _locationData(nullptr),
+                    _batteryCb(nullptr), _batteryData(nullptr),
+                    _percent(100), _charging(false)
+  {
+    forEachSensor<Sensors>([this](auto i) {
+      using S = SensorAt<decltype(i)::value, Sensors>;
+      Listener& l = _listeners[i];
+      l.native = S::native;
+      l.channels = S::channels;
+      l.listener = nullptr;
+      l.cb = nullptr;
+      l.data = nullptr;
+    });
+  }
+
+  ~TizenPlatform()
+  {
+    unwatchBattery();
+    stopLocation();
+    if (_location) {
+      int ret = location_manager_destroy(_location);
+      if (ret != LOCATIONS_ERROR_NONE)
+        dlog_print(DLOG_INFO, LOG_TAG,
+                   "[-] location_manager_destroy() failed. (%d)", ret);
+    }
+    for (Listener& l : _listeners) {
+      if (l.listener)
+        sensor_destroy_listener(l.listener);
+    }
+  }
+
+  TizenPlatform(const TizenPlatform&) = delete;
+  TizenPlatform& operator=(const TizenPlatform&) = delete;
+
+  bool startSensor(std::size_t sensor, int periodMs, SampleCb cb,
+                   void *data) override
+  {
+    Listener& l = _listeners[sensor];
+    if (!l.listener) {
+      sensor_h handle;
+      if (sensor_get_default_sensor(l.native, &handle) != SENSOR_ERROR_NONE ||
+          sensor_create_listener(handle, &l.listener) != SENSOR_ERROR_NONE) {
+        l.listener = nullptr;
+        return false;
+      }
+    }
+    l.cb = cb;
+    l.data = data;
+    // See https://stackoverflow.com/questions/49752776
+    sensor_listener_set_option(l.listener, SENSOR_OPTION_ALWAYS_ON);
+    sensor_listener_set_attribute_int(l.listener, SENSOR_ATTRIBUTE_PAUSE_POLICY,
+                                      SENSOR_PAUSE_NONE);
+    sensor_listener_set_event_cb(l.listener, periodMs, eventCb, &l);
+    return sensor_listener_start(l.listener) == SENSOR_ERROR_NONE;
+  }
+
+  void setSensorPeriod(std::size_t sensor, int periodMs) override
+  {
+    if (_listeners[sensor].listener)
+      sensor_listener_set_interval(_listeners[sensor].listener, periodMs);
+  }
+
+  void stopSensor(std::size_t sensor) override
+  {
+    if (_listeners[sensor].listener)
+      sensor_listener_stop(_listeners[sensor].listener);
+  }
+
+  void setCpuLock(bool lock) override
+  {
+    // See https://stackoverflow.com/questions/49752776
+    if (lock)
+      device_power_request_lock(POWER_LOCK_CPU, 0);
+    else
+      device_power_release_lock(POWER_LOCK_CPU);
+  }
+
+  bool startLocation(int periodS, int method, LocationCb cb,
+                     void *data) override
+  {
+    int ret;
+    // The method is fixed when the manager is created: switch managers
+    if (_location && method != _method) {
+      stopLocation();
+      if (_locationRunning)
+        return false;
+      location_manager_destroy(_location);
+      _location = nullptr;
+    }
+    if (!_location) {
+      /* Create the location service to use the positioning sources of
+         `method` */
+      ret = location_manager_create(method == LOCATION_GPS
+                                        ? LOCATIONS_METHOD_GPS
+                                        : LOCATIONS_METHOD_HYBRID,
+                                    &_location);
+      if (ret != LOCATIONS_ERROR_NONE) {
+        dlog_print(DLOG_INFO, LOG_TAG,
+                   "[-] location_manager_create() failed. (%d)", ret);
+        _location = nullptr;
+        return false;
+      }
+      _method = method;
+      ret = location_manager_set_service_state_changed_cb(_location,
+                                                          stateChangedCb, this);
+      if (ret != LOCATIONS_ERROR_NONE) {
+        dlog_print(DLOG_INFO, LOG_TAG,
+                   "[-] location_manager_set_state_changed_cb() failed. (%d)", ret);
+      }
+    }
+
+    _locationCb = cb;
+    _locationData = data;
+    ret = location_manager_set_position_updated_cb(_location, positionUpdatedCb,
+                                                   periodS, this);
+    if (ret != LOCATIONS_ERROR_NONE) {
+      dlog_print(DLOG_INFO, LOG_TAG,
+                 "[-] location_manager_set_position_updated_cb() failed. (%d)", ret);
+    }
+
+    if (_locationRunning)
+      return true;
+    ret = location_manager_start(_location);
+    if (ret != LOCATIONS_ERROR_NONE) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "location_manager_start() failed: %d",
+                 ret);
+      return false;
+    }
+    dlog_print(DLOG_DEBUG, LOG_TAG, "location service was started");
+    _locationRunning = true;
+    return true;
+  }
+
+  void stopLocation() override
+  {
+    if (!_locationRunning)
+      return;
+    int ret = location_manager_stop(_location);
+    if (ret != LOCATIONS_ERROR_NONE) {
+      dlog_print(DLOG_ERROR, LOG_TAG, "location_manager_stop() failed: %d",
+                 ret);
+      return;
+    }
+    dlog_print(DLOG_DEBUG, LOG_TAG, "location service was stopped.");
+    _locationRunning = false;
+  }
+
+  int batteryPercent() override
+  {
+    device_battery_get_percent(&_percent);
+    return _percent;
+  }
+
+  bool batteryCharging() override
+  {
+    device_battery_is_charging(&_charging);
+    return _charging;
+  }
+
+  void watchBattery(BatteryCb cb, void *data) override
+  {
+    if (!_batteryCb) {
+      device_add_callback(DEVICE_CALLBACK_BATTERY_CAPACITY, deviceCb, this);
+      device_add_callback(DEVICE_CALLBACK_BATTERY_CHARGING, deviceCb, this);
+    }
+    _batteryCb = cb;
+    _batteryData = data;
+  }
+
+  void unwatchBattery() override
+  {
+    if (!_batteryCb)
+      return;
+    device_remove_callback(DEVICE_CALLBACK_BATTERY_CAPACITY, deviceCb);
+    device_remove_callback(DEVICE_CALLBACK_BATTERY_CHARGING, deviceCb);
+    _batteryCb = nullptr;
+  }
+
+  std::string dataPath() override
+  {
+    char *path = app_get_data_path();
+    std::string s(path ? path : "");
+    free(path);
+    return s;
+  }
+
+private:
+  struct Listener {
+    sensor_type_e native;
+    std::size_t channels; // values expected per event
+    sensor_listener_h listener;
+    SampleCb cb;
+    void *data;
+  };
+
+  static void eventCb(sensor_h, sensor_event_s *event, void *data)
+  {
+    Listener *l = (Listener *)data;
+    // Sample callbacks read `channels` values; drop short events
+    if (event->value_count < (int)l->channels)
+      return;
+    l->cb(event->values, l->data);
+  }
+
+  static void positionUpdatedCb(double latitude, double longitude,
+                                double altitude, time_t timestamp, void *data)
+  {
+    TizenPlatform *self = (TizenPlatform *)data;
+    if (self->_locationCb)
+      self->_locationCb(latitude, longitude, altitude, timestamp,
+                        self->_locationData);
+  }
+
+  static void stateChangedCb(location_service_state_e state, void *)
+  {
+    if (state == LOCATIONS_SERVICE_ENABLED)
+      dlog_print(DLOG_INFO, LOG_TAG, "[+] LOCATIONS_SERVICE_ENABLED");
+    else
+      dlog_print(DLOG_INFO, LOG_TAG, "[+] LOCATIONS_SERVICE_DISABLED");
+  }
+
+  // `DEVICE_CALLBACK_BATTERY_CAPACITY` and `DEVICE_CALLBACK_BATTERY_CHARGING`
+  static void deviceCb(device_callback_e type, void *value, void *data)
+  {
+    TizenPlatform *self = (TizenPlatform *)data;
+    if (type == DEVICE_CALLBACK_BATTERY_CAPACITY)
+      self->_percent = (int)(intptr_t)value;
+    else if (type == DEVICE_CALLBACK_BATTERY_CHARGING)
+      self->_charging = (bool)(intptr_t)value;
+    else
+      return;
+    if (self->_batteryCb)
+      self->_batteryCb(self->_percent, self->_charging, self->_batteryData);
+  }
+
+  Listener _listeners[Sensors::size];
+
+  location_manager_h _location;
+  int _method; // of `_location`
+  bool _locationRunning;
+  LocationCb _locationCb;
+  void *_locationData;
+
+  BatteryCb _batteryCb;
+  void *_batteryData;
+  int _percent;
+  bool _charging;
+};
+
+#endif /* __TIZEN_PLATFORM_H__ */
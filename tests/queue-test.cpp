@@ -0,0 +1,209 @@
+//
+// Tests for `Queue` (src/queue.h): priority order, the `dequeue_batch`
+// timeout, `drainDone` against `forceDone`, capacity back-pressure and
+// `steal`. Exits non-zero on the first failed check.
+//
+//   g++ -std=c++14 -pthread -I src tests/queue-test.cpp -o queue-test
+//   ./queue-test
+//
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "queue.h"
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      exit(1);                                                        \
+    }                                                                 \
+  } while (0)
+
+typedef Queue<int, 3> TestQueue;
+
+static std::unique_ptr<int> item(int v)
+{
+  return std::unique_ptr<int>(new int(v));
+}
+
+static const auto kSettle = std::chrono::milliseconds(50);
+
+// Class 0 first, FIFO within a class, whatever the enqueue order
+static void testPriorityOrder()
+{
+  TestQueue q;
+  q.enqueue(item(20), 2);
+  q.enqueue(item(1), 0);
+  q.enqueue(item(10), 1);
+  q.enqueue(item(2), 0);
+  q.enqueue(item(21), 7); // out of range: lowest class
+  q.enqueue(item(11), 1);
+
+  const int expected[] = {1, 2, 10, 11, 20, 21};
+  for (int v : expected) {
+    auto p = q.dequeue();
+    CHECK(p && *p == v);
+  }
+  CHECK(q.size() == 0);
+
+  q.enqueue(item(20), 2);
+  q.enqueue(item(10), 1);
+  q.enqueue(item(1), 0);
+  std::vector<std::unique_ptr<int>> batch;
+  CHECK(q.dequeue_batch(batch, 2, std::chrono::milliseconds(0)));
+  CHECK(batch.size() == 2 && *batch[0] == 1 && *batch[1] == 10);
+}
+
+// An empty batch with `true` when nothing arrives in time
+static void testBatchTimeout()
+{
+  TestQueue q;
+  std::vector<std::unique_ptr<int>> batch;
+  auto start = std::chrono::steady_clock::now();
+  CHECK(q.dequeue_batch(batch, 8, std::chrono::milliseconds(30)));
+  CHECK(batch.empty());
+  CHECK(std::chrono::steady_clock::now() - start >=
+        std::chrono::milliseconds(25));
+
+  // An item enqueued while waiting ends the wait early
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.enqueue(item(7));
+  });
+  CHECK(q.dequeue_batch(batch, 8, std::chrono::seconds(10)));
+  CHECK(batch.size() == 1 && *batch[0] == 7);
+  producer.join();
+}
+
+// drainDone: queued items are still handed out, then nullptr / false
+static void testDrainDone()
+{
+  TestQueue q;
+  q.enqueue(item(1));
+  q.enqueue(item(2), 1);
+  q.enqueue(item(3), 2);
+  q.drainDone();
+
+  auto p = q.dequeue();
+  CHECK(p && *p == 1);
+  std::vector<std::unique_ptr<int>> batch;
+  CHECK(q.dequeue_batch(batch, 8, std::chrono::seconds(10)));
+  CHECK(batch.size() == 2);
+  CHECK(!q.dequeue());
+  batch.clear();
+  CHECK(!q.dequeue_batch(batch, 8, std::chrono::seconds(10)));
+  CHECK(batch.empty());
+
+  // A consumer blocked on an empty queue is released
+  TestQueue idle;
+  std::atomic<bool> released(false);
+  std::thread consumer([&]() {
+    CHECK(!idle.dequeue());
+    released = true;
+  });
+  std::this_thread::sleep_for(kSettle);
+  CHECK(!released);
+  idle.drainDone();
+  consumer.join();
+  CHECK(released);
+}
+
+// forceDone: consumers stop at once, queued items stay
+static void testForceDone()
+{
+  TestQueue q;
+  q.enqueue(item(1));
+  q.enqueue(item(2), 1);
+  q.forceDone();
+
+  CHECK(!q.dequeue());
+  std::vector<std::unique_ptr<int>> batch;
+  CHECK(!q.dequeue_batch(batch, 8, std::chrono::seconds(10)));
+  CHECK(batch.empty());
+  CHECK(q.size() == 2);
+
+  // clear() makes the queue usable again
+  q.clear();
+  CHECK(q.size() == 0);
+  q.enqueue(item(3));
+  auto p = q.dequeue();
+  CHECK(p && *p == 3);
+
+  TestQueue idle;
+  std::thread consumer([&idle]() { CHECK(!idle.dequeue()); });
+  std::this_thread::sleep_for(kSettle);
+  idle.forceDone();
+  consumer.join();
+}
+
+// With a capacity, enqueue blocks until a consumer makes room
+static void testCapacity()
+{
+  Queue<int> q(2);
+  q.enqueue(item(1));
+  q.enqueue(item(2));
+
+  std::atomic<bool> enqueued(false);
+  std::thread producer([&]() {
+    q.enqueue(item(3));
+    enqueued = true;
+  });
+  std::this_thread::sleep_for(kSettle);
+  CHECK(!enqueued);
+  CHECK(q.size() == 2);
+
+  auto p = q.dequeue();
+  CHECK(p && *p == 1);
+  producer.join();
+  CHECK(enqueued);
+  CHECK(q.size() == 2);
+
+  // steal() makes room as well
+  std::thread producer2([&q]() { q.enqueue(item(4)); });
+  std::vector<std::unique_ptr<int>> taken;
+  std::this_thread::sleep_for(kSettle);
+  CHECK(q.steal(taken, 1) == 1 && *taken[0] == 3);
+  producer2.join();
+
+  // forceDone() releases a producer blocked on a full queue
+  std::thread producer3([&q]() { q.enqueue(item(5)); });
+  std::this_thread::sleep_for(kSettle);
+  q.forceDone();
+  producer3.join();
+}
+
+// steal() takes from the back of the lowest class, returned in FIFO order
+static void testSteal()
+{
+  TestQueue q;
+  q.enqueue(item(1));
+  q.enqueue(item(2));
+  q.enqueue(item(10), 1);
+  q.enqueue(item(20), 2);
+  q.enqueue(item(21), 2);
+
+  std::vector<std::unique_ptr<int>> taken;
+  CHECK(q.steal(taken, 4) == 4);
+  CHECK(*taken[0] == 2 && *taken[1] == 10 && *taken[2] == 20 &&
+        *taken[3] == 21);
+  auto p = q.dequeue();
+  CHECK(p && *p == 1);
+  CHECK(q.size() == 0);
+}
+
+int main()
+{
+  testPriorityOrder();
+  testBatchTimeout();
+  testDrainDone();
+  testForceDone();
+  testCapacity();
+  testSteal();
+  printf("queue: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,208 @@
+//
+// The app's data path on a Linux box: `Collector` (collector.h) runs
+// unchanged on an `EpollLoop` with the simulated sensors, GPS, battery
+// and power lock of fake-platform.h, uploading to an ingest server
+// (tools/ingest-server.cpp) and writing its archive, spill file and
+// recording to `--dir`. Meant for profiling and benchmarking the real
+// code; `--speedup N` delivers N samples per device period.
+//
+// At the end it prints what was sampled, uploaded, streamed and recorded,
+// with the process CPU time. While it runs, the archive can be queried
+// through the fetch server (src/fetch.h) on `--fetch-port`, e.g.
+//
+//   curl 'localhost:8081/summary?sensor=0&level=0&from=0&to=9999999999'
+//
+//   cmake -S . -B build && cmake --build build --target drunkare-host
+//   ./build/drunkare-host --server localhost:8080 --duration 120 --speedup 10
+//
+// or without CMake
+//
+//   g++ -std=c++17 -O2 -pthread -I tools/shim -I src tools/drunkare-host.cpp -lcurl -lz -o drunkare-host
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "collector.h"
+#include "fake-platform.h"
+
+struct Options {
+  std::string server = "localhost:8080";
+  std::string dir = "/tmp/drunkare-host/";
+  double duration = 60; // s
+  int speedup = 1;
+  int battery = 100;    // %
+  double drain = 0;     // % per hour
+  double burstPeriod = 120; // s
+  float wobble = 1;         // motion between bursts
+  bool gps = false;
+  bool stream = true;
+  bool record = true;
+  bool pyramid = true;
+  bool idle = true;
+  int fetchPort = FETCH_PORT; // 0: off
+};
+
+struct Host {
+  EpollLoop loop;
+  FakePlatform<AppSensors> platform{loop};
+  Collector collector{loop, platform};
+};
+
+static bool stopCb(void *data)
+{
+  Host *host = (Host *)data;
+  if (host->collector.measuring())
+    host->collector.stop();
+  return false;
+}
+
+static bool quitCb(void *data)
+{
+  ((Host *)data)->loop.quit();
+  return false;
+}
+
+static double cpuSeconds()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [--server HOST:PORT] [--dir DIR] [--duration S] "
+          "[--speedup N] [--battery PERCENT] [--drain PERCENT_PER_HOUR] "
+          "[--burst-period S] [--wobble F] [--gps] [--no-stream] "
+          "[--no-record] [--no-pyramid] [--no-idle] [--fetch-port N] "
+          "[--verbose]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--server") && i + 1 < argc)
+      opt.server = argv[++i];
+    else if (!strcmp(argv[i], "--dir") && i + 1 < argc)
+      opt.dir = std::string(argv[++i]) + "/";
+    else if (!strcmp(argv[i], "--duration") && i + 1 < argc)
+      opt.duration = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--speedup") && i + 1 < argc)
+      opt.speedup = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--battery") && i + 1 < argc)
+      opt.battery = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--drain") && i + 1 < argc)
+      opt.drain = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--burst-period") && i + 1 < argc)
+      opt.burstPeriod = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--wobble") && i + 1 < argc)
+      opt.wobble = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--gps"))
+      opt.gps = true;
+    else if (!strcmp(argv[i], "--no-stream"))
+      opt.stream = false;
+    else if (!strcmp(argv[i], "--no-record"))
+      opt.record = false;
+    else if (!strcmp(argv[i], "--no-idle"))
+      opt.idle = false;
+    else if (!strcmp(argv[i], "--no-pyramid"))
+      opt.pyramid = false;
+    else if (!strcmp(argv[i], "--fetch-port") && i + 1 < argc)
+      opt.fetchPort = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--verbose"))
+      dlogLevel = DLOG_DEBUG;
+    else
+      usage(argv[0]);
+  }
+  if (opt.speedup < 1)
+    usage(argv[0]);
+  mkdir(opt.dir.c_str(), 0700);
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  Host host;
+  host.platform.speedup = opt.speedup;
+  host.platform.burstPeriod = opt.burstPeriod;
+  host.platform.wobble = opt.wobble;
+  host.platform.percent = opt.battery;
+  host.platform.drainPerHour = opt.drain;
+  host.platform.path = opt.dir;
+
+  Collector& c = host.collector;
+  c.dataUrl = opt.server + "/data/";
+  c.gpsUrl = opt.server + "/data/gps";
+  c.streamUrl = opt.server + "/stream";
+  c._stream = opt.stream;
+  c._record = opt.record;
+  c._uploadPyramid = opt.pyramid;
+  c._suppressIdle = opt.idle;
+  c.fetchPort = opt.fetchPort;
+  c.create();
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  double cpu0 = cpuSeconds();
+  c.start(0);
+  if (opt.gps)
+    c.startLocation();
+  host.loop.addTimer(opt.duration, stopCb, &host);
+  host.loop.addTimer(opt.duration + 2, quitCb, &host);
+  host.loop.run();
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - t0;
+  double cpu = cpuSeconds() - cpu0;
+
+  uint64_t samples = 0;
+  forEachSensor<AppSensors>([&](auto i) {
+    using S = SensorAt<decltype(i)::value, AppSensors>;
+    printf("%-6s %10llu samples\n", S::name(),
+           (unsigned long long)host.platform.samples[i]);
+    samples += host.platform.samples[i];
+  });
+  const HttpMetrics& h = c.http->metrics;
+  printf("http   %10llu submitted, %llu ok, %llu failed, %llu retried, "
+         "%.3f MB sent\n",
+         (unsigned long long)h.submitted, (unsigned long long)h.succeeded,
+         (unsigned long long)h.failed, (unsigned long long)h.retried,
+         h.bytesSent / 1e6);
+  const StreamMetrics& s = c.stream->metrics;
+  uint64_t idleWindows = 0, idleRuns = 0;
+  forEachSensor<AppSensors>([&](auto i) {
+    idleWindows += std::get<decltype(i)::value>(c.idleRuns).absorbed;
+    idleRuns += std::get<decltype(i)::value>(c.idleRuns).runs;
+  });
+  printf("idle   %10llu windows in %llu runs\n",
+         (unsigned long long)idleWindows, (unsigned long long)idleRuns);
+  if (c.fetch) {
+    printf("fetch  %10llu requests, %llu bytes served\n",
+           (unsigned long long)c.fetch->requests,
+           (unsigned long long)c.fetch->bytesOut);
+  }
+  printf("stream %10llu chunks, %llu bytes, %llu resent, %llu dropped\n",
+         (unsigned long long)s.chunks, (unsigned long long)s.bytes,
+         (unsigned long long)s.resent, (unsigned long long)s.dropped);
+  printf("record %10llu windows, %llu bytes\n",
+         (unsigned long long)c.recorder.records(),
+         (unsigned long long)c.recorder.bytes());
+  printf("power  profile %s, %llu cpu locks\n",
+         powerProfiles[c._profile].name,
+         (unsigned long long)host.platform.cpuLocks);
+  printf("gps    %llu fixes, %llu method switches, every %d s at the end\n",
+         (unsigned long long)host.platform.fixes,
+         (unsigned long long)host.platform.methodSwitches,
+         host.platform.locationPeriod);
+  printf("cpu    %.2f s over %.1f s wall (%.1f%%), %.2f us per sample\n",
+         cpu, wall.count(), 100 * cpu / wall.count(),
+         samples ? cpu * 1e6 / samples : 0.0);
+
+  c.destroy();
+  curl_global_cleanup();
+  return 0;
+}
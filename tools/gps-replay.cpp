@@ -0,0 +1,344 @@
+//
+// Replay evaluation of the motion-aware GPS schedule (gps.h) against the
+// fixed period of the power profile.
+//
+// A motion trace (stored accelerometer samples) and a location trace
+// (where the wearer really was) are replayed on the sample clock. Each
+// policy takes a fix whenever its plan says so; a fix is the true
+// position plus the error of the positioning method. Between fixes the
+// position is taken to be the last fix, and its distance to the true
+// position, once per second, is the trajectory error.
+//
+// Traces are either
+//   --motion data.csv   accelerometer rows (type 0) of a recording made
+//                       with RECORD_CSV (recorder.h), in file order
+//   --track track.csv   "t,latitude,longitude" rows, t in seconds from
+//                       the first motion sample, linearly interpolated
+// or, without --motion, a synthetic day: sleep, walks, a bus ride and
+// desk work with the odd fidget.
+//
+//   g++ -std=c++17 -O2 -I tools/shim -I src tools/gps-replay.cpp -o gps-replay
+//   ./gps-replay --base 60
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "data.h"
+#include "sensors.h"
+#include "gps.h"
+
+struct Options {
+  std::string motion;
+  std::string track;
+  int periodMs = Accelerometer::storedPeriod;
+  int base = 60;          // s, the profile's GPS period
+  double hybridErr = 25;  // m, 1-sigma error of a hybrid fix
+  double gpsErr = 5;      // m, of a GPS-only fix
+  int fixBytes = 96;      // body of one location upload
+  unsigned seed = 1;
+};
+
+struct TrackPoint {
+  double t; // s
+  double x, y; // m east and north of the start
+};
+
+static const double EARTH_M_PER_DEG = 111320.0;
+
+//
+// Synthetic day, one segment per activity. Motion: `still` is gravity
+// plus sensor noise, `walk` adds steps, `ride` vibration; a still segment
+// with `fidget` > 0 has a short burst of motion every that many seconds.
+//
+struct Segment {
+  const char *name;
+  double minutes;
+  enum { STILL, WALK, RIDE } kind;
+  double speed;  // m/s
+  double fidget; // s between fidgets; 0: none
+};
+
+static const Segment day[] = {
+  {"sleep", 420, Segment::STILL, 0, 900},
+  {"home", 40, Segment::STILL, 0, 60},
+  {"walk", 12, Segment::WALK, 1.4, 0},
+  {"bus", 25, Segment::RIDE, 8, 0},
+  {"walk", 6, Segment::WALK, 1.4, 0},
+  {"desk", 210, Segment::STILL, 0, 300},
+  {"walk", 15, Segment::WALK, 1.3, 0},
+  {"lunch", 45, Segment::STILL, 0, 120},
+  {"walk", 15, Segment::WALK, 1.3, 0},
+  {"desk", 240, Segment::STILL, 0, 300},
+  {"walk", 6, Segment::WALK, 1.4, 0},
+  {"bus", 25, Segment::RIDE, 8, 0},
+  {"walk", 12, Segment::WALK, 1.4, 0},
+  {"home", 369, Segment::STILL, 0, 90},
+};
+
+struct Trace {
+  std::vector<float> accel; // x, y, z per sample
+  std::vector<TrackPoint> track;
+};
+
+static void synthesize(Trace& trace, const Options& opt, std::mt19937& rng)
+{
+  std::normal_distribution<double> noise(0, 1);
+  double dt = opt.periodMs / 1000.0;
+  double t = 0, x = 0, y = 0, heading = 0;
+  trace.track.push_back(TrackPoint{0, 0, 0});
+
+  for (const Segment& seg : day) {
+    double end = t + seg.minutes * 60;
+    double lastTrack = t;
+    for (; t < end; t += dt) {
+      double ax = 0.03 * noise(rng), ay = 0.03 * noise(rng);
+      double az = 9.81 + 0.03 * noise(rng);
+      if (seg.kind == Segment::WALK) {
+        az += 2.5 * std::sin(2 * M_PI * 1.8 * t);
+        ax += 1.2 * std::sin(2 * M_PI * 0.9 * t);
+      } else if (seg.kind == Segment::RIDE) {
+        az += 0.4 * noise(rng);
+        ax += 0.3 * noise(rng);
+      } else if (seg.fidget > 0 && std::fmod(t, seg.fidget) < 2.5) {
+        ax += 1.5 * noise(rng);
+        az += 1.0 * noise(rng);
+      }
+      trace.accel.push_back((float)ax);
+      trace.accel.push_back((float)ay);
+      trace.accel.push_back((float)az);
+
+      if (seg.speed > 0) {
+        heading += 0.002 * noise(rng);
+        x += seg.speed * dt * std::cos(heading);
+        y += seg.speed * dt * std::sin(heading);
+        if (t - lastTrack >= 1) {
+          trace.track.push_back(TrackPoint{t, x, y});
+          lastTrack = t;
+        }
+      }
+    }
+    trace.track.push_back(TrackPoint{t, x, y});
+  }
+}
+
+// Accelerometer window rows of a RECORD_CSV recording:
+// id,context,type,kind,x...,y...,z...
+static bool loadMotion(Trace& trace, const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  std::vector<float> row;
+  while (std::getline(in, line)) {
+    row.clear();
+    std::istringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ','))
+      row.push_back((float)atof(field.c_str()));
+    if (row.size() < 7 || row[2] != 0 || row[3] != MEASURE_WINDOW)
+      continue;
+    std::size_t n = (row.size() - 4) / 3;
+    for (std::size_t j = 0; j < n; j++)
+      for (std::size_t c = 0; c < 3; c++)
+        trace.accel.push_back(row[4 + c * n + j]);
+  }
+  return true;
+}
+
+static bool loadTrack(Trace& trace, const std::string& path)
+{
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+    return false;
+  double t, lat, lon, lat0 = NAN, lon0 = NAN;
+  while (fscanf(f, "%lf,%lf,%lf", &t, &lat, &lon) == 3) {
+    if (std::isnan(lat0)) {
+      lat0 = lat;
+      lon0 = lon;
+    }
+    trace.track.push_back(TrackPoint{
+        t, (lon - lon0) * EARTH_M_PER_DEG * std::cos(lat0 * M_PI / 180),
+        (lat - lat0) * EARTH_M_PER_DEG});
+  }
+  fclose(f);
+  return true;
+}
+
+// True position at `t`; `i` is a cursor into the track, only moving forward
+static TrackPoint truth(const Trace& trace, double t, std::size_t& i)
+{
+  const std::vector<TrackPoint>& tr = trace.track;
+  if (tr.empty())
+    return TrackPoint{t, 0, 0};
+  while (i + 1 < tr.size() && tr[i + 1].t <= t)
+    i++;
+  if (i + 1 >= tr.size() || t <= tr[i].t)
+    return TrackPoint{t, tr[i].x, tr[i].y};
+  double a = (t - tr[i].t) / (tr[i + 1].t - tr[i].t);
+  return TrackPoint{t, tr[i].x + a * (tr[i + 1].x - tr[i].x),
+                    tr[i].y + a * (tr[i + 1].y - tr[i].y)};
+}
+
+struct Result {
+  uint64_t fixes = 0;
+  uint64_t gpsFixes = 0;
+  double onSeconds = 0;
+  double gpsSeconds = 0;
+  uint64_t restarts = 0; // location manager started or retuned
+  std::vector<double> errors; // m, once per second
+};
+
+static Result replay(const Trace& trace, const Options& opt, bool adaptive)
+{
+  Result r;
+  std::mt19937 rng(opt.seed);
+  std::normal_distribution<double> noise(0, 1);
+  GpsScheduler sched;
+  GpsPlan plan{opt.base, LOCATION_HYBRID}, running{0, LOCATION_HYBRID};
+  double nextFix = 0, fixX = 0, fixY = 0, nextSecond = 0;
+  bool haveFix = false;
+  std::size_t cursor = 0, cursor2 = 0;
+  double dt = opt.periodMs / 1000.0;
+
+  std::size_t n = trace.accel.size() / 3;
+  for (std::size_t j = 0; j < n; j++) {
+    double t = j * dt;
+    if (adaptive && sched.feed(&trace.accel[3 * j], opt.periodMs))
+      plan = sched.plan(opt.base);
+
+    // Apply the plan like `Collector::applyLocation`: a (re)started
+    // manager fixes right away
+    if (plan.period != running.period ||
+        (plan.period > 0 && plan.method != running.method)) {
+      if (plan.period > 0) {
+        r.restarts++;
+        nextFix = t;
+      }
+      running = plan;
+    }
+
+    if (running.period > 0) {
+      r.onSeconds += dt;
+      if (running.method == LOCATION_GPS)
+        r.gpsSeconds += dt;
+      if (t >= nextFix) {
+        TrackPoint p = truth(trace, t, cursor);
+        double err = running.method == LOCATION_GPS ? opt.gpsErr
+                                                    : opt.hybridErr;
+        fixX = p.x + err * noise(rng);
+        fixY = p.y + err * noise(rng);
+        haveFix = true;
+        r.fixes++;
+        if (running.method == LOCATION_GPS)
+          r.gpsFixes++;
+        sched.fixed();
+        nextFix = t + running.period;
+      }
+    }
+
+    if (t >= nextSecond) {
+      TrackPoint p = truth(trace, t, cursor2);
+      r.errors.push_back(haveFix ? std::hypot(p.x - fixX, p.y - fixY) : 0);
+      nextSecond += 1;
+    }
+  }
+  return r;
+}
+
+static void report(const char *name, Result& r, const Options& opt,
+                   double hours)
+{
+  std::vector<double>& e = r.errors;
+  double sum = 0;
+  std::size_t over = 0;
+  for (double v : e) {
+    sum += v;
+    over += v > 100;
+  }
+  std::sort(e.begin(), e.end());
+  double p50 = e.empty() ? 0 : e[e.size() / 2];
+  double p95 = e.empty() ? 0 : e[e.size() * 95 / 100];
+  double max = e.empty() ? 0 : e.back();
+  printf("%-9s %8.0f %8.0f %8.2f %8.1f %8.0f %9.1f %7.1f %7.1f %8.1f %8.0f "
+         "%7.2f\n",
+         name, r.fixes * 24 / hours, r.gpsFixes * 24 / hours,
+         r.onSeconds / 3600 * 24 / hours, r.gpsSeconds / 60 * 24 / hours,
+         r.restarts * 24 / hours,
+         r.fixes * opt.fixBytes * 24 / hours / 1e3,
+         e.empty() ? 0 : sum / e.size(), p50, p95, max,
+         e.empty() ? 0 : 100.0 * over / e.size());
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [--motion data.csv] [--track track.csv] "
+          "[--period-ms MS] [--base S] [--hybrid-err M] [--gps-err M] "
+          "[--seed N]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--motion") && i + 1 < argc)
+      opt.motion = argv[++i];
+    else if (!strcmp(argv[i], "--track") && i + 1 < argc)
+      opt.track = argv[++i];
+    else if (!strcmp(argv[i], "--period-ms") && i + 1 < argc)
+      opt.periodMs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--base") && i + 1 < argc)
+      opt.base = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--hybrid-err") && i + 1 < argc)
+      opt.hybridErr = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--gps-err") && i + 1 < argc)
+      opt.gpsErr = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      opt.seed = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+  if (opt.periodMs <= 0 || opt.base <= 0)
+    usage(argv[0]);
+
+  Trace trace;
+  std::mt19937 rng(opt.seed);
+  if (opt.motion.empty()) {
+    synthesize(trace, opt, rng);
+  } else {
+    if (!loadMotion(trace, opt.motion)) {
+      fprintf(stderr, "cannot read %s\n", opt.motion.c_str());
+      return 1;
+    }
+    if (!opt.track.empty() && !loadTrack(trace, opt.track)) {
+      fprintf(stderr, "cannot read %s\n", opt.track.c_str());
+      return 1;
+    }
+  }
+
+  double hours = trace.accel.size() / 3 * opt.periodMs / 3600e3;
+  if (hours <= 0) {
+    fprintf(stderr, "empty motion trace\n");
+    return 1;
+  }
+  printf("trace: %.1f h of motion, %zu track points, base period %d s\n\n",
+         hours, trace.track.size(), opt.base);
+  printf("%-9s %8s %8s %8s %8s %8s %9s %7s %7s %8s %8s %7s\n", "policy",
+         "fixes/d", "gps/d", "on h/d", "gps m/d", "starts/d", "upload kB",
+         "err m", "p50 m", "p95 m", "max m", ">100m %");
+  Result fixed = replay(trace, opt, false);
+  report("fixed", fixed, opt, hours);
+  Result adaptive = replay(trace, opt, true);
+  report("adaptive", adaptive, opt, hours);
+  return 0;
+}
@@ -0,0 +1,280 @@
+//
+// Replay evaluation of idle-run suppression (idle.h): what a day of
+// windows costs on the network and in the archive with every window kept,
+// and with idle windows collapsed into runs as `Collector` does.
+//
+// Each sensor's samples are cut into `DURATION` windows at its stored
+// rate and closed one after the other through an `IdleSuppressor` with
+// the app's noise floors (`idleFloors`, `IDLE_RUN_MAX`). Every record that
+// would be queued is serialized raw and as pyramid summaries (collector.h
+// uploads the latter by default), gzipped as the upload pipeline does,
+// and sized as an archive record.
+//
+// Traces are either
+//   --data data.csv   rows of a recording made with RECORD_CSV (recorder.h)
+//                     and without SUPPRESS_IDLE, at full profile rates
+// or, without --data, a synthetic day: sleep, walks, bus rides and desk
+// work with the odd fidget.
+//
+//   g++ -std=c++17 -O2 -pthread -I tools/shim -I src tools/idle-replay.cpp -lcurl -lz -o idle-replay
+//   ./idle-replay
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <sstream>
+
+#include "collector.h"
+
+struct Options {
+  std::string data;
+  float floorScale = 1; // applied to `idleFloors`
+  unsigned seed = 1;
+};
+
+//
+// Synthetic day, one segment per activity. `still` is the sensor's noise
+// (plus gravity on the accelerometer), `walk` adds the arm swing, `ride`
+// vibration; a still segment with `fidget` > 0 has a short burst of
+// motion every that many seconds.
+//
+struct Segment {
+  const char *name;
+  double minutes;
+  enum { STILL, WALK, RIDE } kind;
+  double fidget; // s between fidgets; 0: none
+};
+
+static const Segment day[] = {
+  {"sleep", 420, Segment::STILL, 900},
+  {"home", 40, Segment::STILL, 60},
+  {"walk", 12, Segment::WALK, 0},
+  {"bus", 25, Segment::RIDE, 0},
+  {"walk", 6, Segment::WALK, 0},
+  {"desk", 210, Segment::STILL, 300},
+  {"walk", 15, Segment::WALK, 0},
+  {"lunch", 45, Segment::STILL, 120},
+  {"walk", 15, Segment::WALK, 0},
+  {"desk", 240, Segment::STILL, 300},
+  {"walk", 6, Segment::WALK, 0},
+  {"bus", 25, Segment::RIDE, 0},
+  {"walk", 12, Segment::WALK, 0},
+  {"home", 369, Segment::STILL, 90},
+};
+
+// Signal levels of a sensor, in its units
+struct Model {
+  double gravity; // on the last channel
+  double noise;   // std while still
+  double swing;   // walking amplitude
+  double ride;    // vibration std on a bus
+  double fidget;  // std during a fidget
+};
+
+static const Model accelModel = {9.81, 0.02, 2.5, 0.4, 1.5}; // m/s^2
+static const Model gyroModel = {0, 0.3, 40, 6, 30};          // deg/s
+
+static void synthesize(std::vector<float>& v, int periodMs, const Model& m,
+                       std::mt19937& rng)
+{
+  std::normal_distribution<double> noise(0, 1);
+  double dt = periodMs / 1000.0;
+  double t = 0;
+  for (const Segment& seg : day) {
+    double end = t + seg.minutes * 60;
+    for (; t < end; t += dt) {
+      double s[3] = {m.noise * noise(rng), m.noise * noise(rng),
+                     m.gravity + m.noise * noise(rng)};
+      if (seg.kind == Segment::WALK) {
+        s[0] += 0.5 * m.swing * std::sin(2 * M_PI * 0.9 * t);
+        s[2] += m.swing * std::sin(2 * M_PI * 1.8 * t);
+      } else if (seg.kind == Segment::RIDE) {
+        s[0] += m.ride * noise(rng);
+        s[2] += m.ride * noise(rng);
+      } else if (seg.fidget > 0 && std::fmod(t, seg.fidget) < 2.5) {
+        s[0] += m.fidget * noise(rng);
+        s[2] += m.fidget * noise(rng);
+      }
+      for (double x : s)
+        v.push_back((float)x);
+    }
+  }
+}
+
+// Window rows of sensor `type` of a RECORD_CSV recording:
+// id,context,type,kind,columns
+static bool loadData(std::vector<float>& v, std::size_t channels, int type,
+                     const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  std::vector<float> row;
+  while (std::getline(in, line)) {
+    row.clear();
+    std::istringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ','))
+      row.push_back((float)atof(field.c_str()));
+    if (row.size() < 4 + channels || row[2] != type ||
+        row[3] != MEASURE_WINDOW)
+      continue;
+    std::size_t n = (row.size() - 4) / channels;
+    for (std::size_t j = 0; j < n; j++)
+      for (std::size_t c = 0; c < channels; c++)
+        v.push_back(row[4 + c * n + j]);
+  }
+  return true;
+}
+
+// What the queued records of one policy cost
+struct Volume {
+  uint64_t records = 0;
+  uint64_t idleWindows = 0;
+  uint64_t runs = 0;
+  uint64_t raw = 0, rawGz = 0;         // bytes of formatJson bodies
+  uint64_t pyramid = 0, pyramidGz = 0; // of formatPyramidJson bodies
+  uint64_t archive = 0;                // of archive records
+
+  void add(MeasureBase& m)
+  {
+    records++;
+    Payload p;
+    p.body = m.formatJson();
+    raw += p.body.size();
+    gzipPayload(p, 0);
+    rawGz += p.body.size();
+    p.body = m.formatPyramidJson();
+    p.contentEncoding.clear();
+    pyramid += p.body.size();
+    gzipPayload(p, 0);
+    pyramidGz += p.body.size();
+    archive += sizeof(Archive::RecordHeader) +
+               sizeof(float) * m._numChannels() * m._numSamples();
+  }
+};
+
+// Replay the samples `v` of sensor `I` of `AppSensors`
+template <std::size_t I>
+static void replay(const std::vector<float>& v, bool suppress, float scale,
+                   Volume& vol)
+{
+  using S = SensorAt<I, AppSensors>;
+  IdleSuppressor<S> idle;
+  idle.floor = IdleFloor{idleFloors[I].std * scale,
+                         idleFloors[I].range * scale};
+  idle.maxWindows = IDLE_RUN_MAX;
+
+  auto endRun = [&]() {
+    if (auto run = idle.take()) {
+      vol.runs++;
+      vol.add(*run);
+    }
+  };
+  auto close = [&](TMeasure<S>& w) {
+    if (suppress && idle.absorb(w)) {
+      vol.idleWindows++;
+      if (idle.full())
+        endRun();
+      return;
+    }
+    endRun();
+    vol.add(w);
+  };
+
+  std::size_t n = v.size() / S::channels;
+  unsigned long long t0 = 1700000000;
+  int id = 0;
+  std::unique_ptr<TMeasure<S>> w;
+  for (std::size_t j = 0; j < n; j++) {
+    if (!w) {
+      w.reset(new TMeasure<S>(id, I, 0, t0 + (unsigned long long)id * DURATION));
+      id++;
+    }
+    w->push(&v[j * S::channels]);
+    if (w->_done) {
+      close(*w);
+      w.reset();
+    }
+  }
+  if (w)
+    close(*w);
+  endRun();
+}
+
+static void report(const char *name, const Volume& v, double hours)
+{
+  double d = 24 / hours;
+  printf("%-8s %8.0f %8.0f %6.0f %9.2f %9.2f %10.1f %10.1f %10.2f\n", name,
+         v.records * d, v.idleWindows * d, v.runs * d, v.raw * d / 1e6,
+         v.rawGz * d / 1e6, v.pyramid * d / 1e3, v.pyramidGz * d / 1e3,
+         v.archive * d / 1e6);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [--data data.csv] [--floor-scale F] [--seed N]\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--data") && i + 1 < argc)
+      opt.data = argv[++i];
+    else if (!strcmp(argv[i], "--floor-scale") && i + 1 < argc)
+      opt.floorScale = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      opt.seed = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+  if (opt.floorScale <= 0)
+    usage(argv[0]);
+
+  std::vector<float> traces[NUM_SENSORS];
+  std::mt19937 rng(opt.seed);
+  bool ok = true;
+  forEachSensor<AppSensors>([&](auto i) {
+    using S = SensorAt<decltype(i)::value, AppSensors>;
+    if (opt.data.empty())
+      synthesize(traces[i], S::storedPeriod,
+                 S::native == SENSOR_GYROSCOPE ? gyroModel : accelModel, rng);
+    else
+      ok = ok && loadData(traces[i], S::channels, i, opt.data);
+  });
+  if (!ok) {
+    fprintf(stderr, "cannot read %s\n", opt.data.c_str());
+    return 1;
+  }
+
+  Volume kept, suppressed;
+  double hours = 0;
+  forEachSensor<AppSensors>([&](auto i) {
+    using S = SensorAt<decltype(i)::value, AppSensors>;
+    hours = std::max(hours, traces[i].size() / S::channels *
+                                S::storedPeriod / 3600e3);
+    replay<decltype(i)::value>(traces[i], false, opt.floorScale, kept);
+    replay<decltype(i)::value>(traces[i], true, opt.floorScale, suppressed);
+  });
+  if (hours <= 0) {
+    fprintf(stderr, "empty trace\n");
+    return 1;
+  }
+
+  printf("trace: %.1f h, %zu sensors, per day:\n\n", hours, NUM_SENSORS);
+  printf("%-8s %8s %8s %6s %9s %9s %10s %10s %10s\n", "policy", "records",
+         "idle win", "runs", "raw MB", "raw gz MB", "pyramid kB", "pyr gz kB",
+         "archive MB");
+  report("all", kept, hours);
+  report("idle", suppressed, hours);
+  return 0;
+}
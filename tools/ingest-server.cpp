@@ -0,0 +1,1103 @@
+//
+// Local stand-in for the ingest server the app uploads to.
+//
+// Endpoints:
+//   POST /data/      one window or an array of windows. JSON windows must
+//                    look like `Measure::formatJson` (raw windows and event
+//                    segments), `Measure::formatSummaryJson`,
+//                    `Measure::formatPyramidJson` or `IdleRun::formatJson`;
+//                    bodies sent
+//                    as application/octet-stream must be a sequence of
+//                    `Archive` records.
+//                    Uploads may be sent with `Content-Encoding: gzip`.
+//   POST /data/gps   {"timestamp", "user_id", "latitude", "longitude"}
+//   POST /stream?user_id=U&session=S
+//                    live stream (see stream.h): a chunked body of JSON
+//                    lines, each handled as soon as it arrives. Ends with
+//                    {"next_seq":N}, the seq expected next.
+//   GET  /stream/resume?user_id=U&session=S
+//                    {"next_seq":N} for a client reconnecting
+//   GET  /stats      counters as JSON
+//   POST /control    change fault injection at runtime, e.g.
+//                    {"latency_ms":200,"error_rate":0.1}
+//
+// Fault injection (flags or /control):
+//   latency_ms, jitter_ms  delay every response
+//   error_rate             fraction of uploads answered with 503
+//   reset_rate             fraction of uploads (and stream lines) answered
+//                          with a TCP reset
+//   slow_read_bps          throttle how fast request bodies are read
+//
+// Each accepted upload and stream line can be logged (--log) as
+//   receipt time (us), endpoint, bytes, status, user_id, id (seq)
+//
+// Stream lines are checked for gaps and duplicates, and the age of their
+// oldest sample on receipt (now - t0_us) goes into a latency histogram
+// reported by /stats.
+//
+//   g++ -std=c++14 -O2 -I src tools/ingest-server.cpp -lz -o ingest-server
+//   ./ingest-server --port 8080 --log receipts.csv
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <random>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <zlib.h>
+
+#include "loop.h"
+#include "archive.h"
+
+//
+// Minimal JSON DOM, enough to validate upload payloads
+//
+struct Json {
+  enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  double number = 0;
+  std::string string;
+  std::vector<Json> items;
+  std::map<std::string, Json> fields;
+
+  const Json *get(const char *key) const
+  {
+    auto it = fields.find(key);
+    return it == fields.end() ? nullptr : &it->second;
+  }
+};
+
+struct JsonParser {
+  const char *p, *end;
+
+  JsonParser(const std::string& s) : p(s.data()), end(s.data() + s.size()) {}
+
+  void ws()
+  {
+    while (p < end && isspace((unsigned char)*p))
+      p++;
+  }
+
+  bool literal(const char *word)
+  {
+    std::size_t n = strlen(word);
+    if ((std::size_t)(end - p) < n || strncmp(p, word, n))
+      return false;
+    p += n;
+    return true;
+  }
+
+  bool string(std::string& out)
+  {
+    if (p >= end || *p != '"')
+      return false;
+    p++;
+    while (p < end && *p != '"') {
+      if (*p == '\\') {
+        if (++p >= end)
+          return false;
+        if (*p == 'u') {
+          if (end - p < 5)
+            return false;
+          p += 4;
+        }
+      }
+      out += *p++;
+    }
+    if (p >= end)
+      return false;
+    p++;
+    return true;
+  }
+
+  bool value(Json& v, int depth = 0)
+  {
+    if (depth > 32)
+      return false;
+    ws();
+    if (p >= end)
+      return false;
+    switch (*p) {
+    case '{': {
+      v.type = Json::OBJECT;
+      p++;
+      ws();
+      if (p < end && *p == '}') {
+        p++;
+        return true;
+      }
+      while (true) {
+        std::string key;
+        ws();
+        if (!string(key))
+          return false;
+        ws();
+        if (p >= end || *p++ != ':')
+          return false;
+        if (!value(v.fields[key], depth + 1))
+          return false;
+        ws();
+        if (p < end && *p == ',') {
+          p++;
+          continue;
+        }
+        if (p < end && *p == '}') {
+          p++;
+          return true;
+        }
+        return false;
+      }
+    }
+    case '[': {
+      v.type = Json::ARRAY;
+      p++;
+      ws();
+      if (p < end && *p == ']') {
+        p++;
+        return true;
+      }
+      while (true) {
+        v.items.emplace_back();
+        if (!value(v.items.back(), depth + 1))
+          return false;
+        ws();
+        if (p < end && *p == ',') {
+          p++;
+          continue;
+        }
+        if (p < end && *p == ']') {
+          p++;
+          return true;
+        }
+        return false;
+      }
+    }
+    case '"':
+      v.type = Json::STRING;
+      return string(v.string);
+    case 't':
+      v.type = Json::BOOL;
+      v.number = 1;
+      return literal("true");
+    case 'f':
+      v.type = Json::BOOL;
+      return literal("false");
+    case 'n':
+      return literal("null");
+    default: {
+      char *num_end;
+      std::string num(p, std::min<std::size_t>(end - p, 64));
+      v.type = Json::NUMBER;
+      v.number = strtod(num.c_str(), &num_end);
+      if (num_end == num.c_str())
+        return false;
+      p += num_end - num.c_str();
+      return true;
+    }
+    }
+  }
+
+  bool parse(Json& v)
+  {
+    if (!value(v))
+      return false;
+    ws();
+    return p == end;
+  }
+};
+
+static bool isNumber(const Json *v)
+{
+  return v && v->type == Json::NUMBER;
+}
+
+//
+// Checks the levels of a `Measure::formatPyramidJson` window:
+// {"10":[{"t":..,"n":..,"<axis>":[min,max,mean,energy],...},...],...}
+//
+static bool validLevels(const Json& sensor, std::string& why)
+{
+  for (auto& level : sensor.fields) {
+    if (level.second.type != Json::ARRAY) {
+      why = "level " + level.first + " is not an array";
+      return false;
+    }
+    for (const Json& cell : level.second.items) {
+      if (cell.type != Json::OBJECT || !isNumber(cell.get("t")) ||
+          !isNumber(cell.get("n"))) {
+        why = "cell of level " + level.first + " lacks t/n";
+        return false;
+      }
+      for (auto& kv : cell.fields) {
+        if (kv.first == "t" || kv.first == "n")
+          continue;
+        const Json& a = kv.second;
+        if (a.type != Json::ARRAY || a.items.size() != 4 ||
+            !isNumber(&a.items[0]) || !isNumber(&a.items[1]) ||
+            !isNumber(&a.items[2]) || !isNumber(&a.items[3])) {
+          why = "axis " + kv.first + " is not [min,max,mean,energy]";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// `S::name()` of every sensor in sensors.h
+static const char *const sensorNames[] = {"accel", "gyro", "hrm"};
+
+//
+// Checks one `Measure::formatJson`, `formatSummaryJson` or
+// `formatPyramidJson` window, or an `IdleRun`; fills `userId`/`id`
+//
+static bool validWindow(const Json& w, std::string& why, int& userId, int& id)
+{
+  if (w.type != Json::OBJECT) {
+    why = "window is not an object";
+    return false;
+  }
+  if (!isNumber(w.get("user_id")) || !isNumber(w.get("id")) ||
+      !isNumber(w.get("timestamps"))) {
+    why = "missing user_id/id/timestamps";
+    return false;
+  }
+  userId = (int)w.get("user_id")->number;
+  id = (int)w.get("id")->number;
+
+  // The sensor object is keyed by the sensor's JSON name (see sensors.h)
+  const Json *sensor = nullptr;
+  for (const char *name : sensorNames) {
+    const Json *o = w.get(name);
+    if (o && o->type == Json::OBJECT)
+      sensor = o;
+  }
+  if (!sensor || sensor->fields.empty()) {
+    why = "missing sensor object";
+    return false;
+  }
+  const Json *kind = w.get("kind");
+  if (kind && kind->type == Json::STRING && kind->string == "pyramid")
+    return validLevels(*sensor, why);
+  if (kind && kind->type == Json::STRING && kind->string == "idle") {
+    // {"end":.., "<sensor>":{"<axis>":<mean>, ...}}
+    if (!isNumber(w.get("end"))) {
+      why = "idle run without end";
+      return false;
+    }
+    for (auto& kv : sensor->fields) {
+      if (kv.second.type != Json::NUMBER) {
+        why = "idle axis " + kv.first + " is not a number";
+        return false;
+      }
+    }
+    return true;
+  }
+  std::size_t n = sensor->fields.begin()->second.items.size();
+  for (auto& kv : sensor->fields) {
+    const Json *a = &kv.second;
+    if (a->type == Json::OBJECT) {
+      // Summary: {"min":..,"max":..,"mean":..,"rms":..}
+      if (!isNumber(a->get("min")) || !isNumber(a->get("max")) ||
+          !isNumber(a->get("mean"))) {
+        why = "axis " + kv.first + " lacks min/max/mean";
+        return false;
+      }
+      continue;
+    }
+    if (a->type != Json::ARRAY) {
+      why = "axis " + kv.first + " is not an array";
+      return false;
+    }
+    if (a->items.size() != n) {
+      why = "axes differ in length";
+      return false;
+    }
+    for (const Json& x : a->items) {
+      if (x.type != Json::NUMBER) {
+        why = "non-numeric sample";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool validGps(const Json& g, std::string& why, int& userId)
+{
+  if (g.type != Json::OBJECT || !isNumber(g.get("timestamp")) ||
+      !isNumber(g.get("user_id")) || !isNumber(g.get("latitude")) ||
+      !isNumber(g.get("longitude"))) {
+    why = "expected timestamp/user_id/latitude/longitude";
+    return false;
+  }
+  userId = (int)g.get("user_id")->number;
+  double lat = g.get("latitude")->number, lon = g.get("longitude")->number;
+  if (lat < -90 || lat > 90 || lon < -180 || lon > 180) {
+    why = "coordinates out of range";
+    return false;
+  }
+  return true;
+}
+
+// Binary uploads: back-to-back `Archive` records
+static bool validRecords(const std::string& body, std::string& why,
+                         std::size_t& count, int& id)
+{
+  std::size_t off = 0;
+  count = 0;
+  while (off < body.size()) {
+    Archive::RecordHeader hdr;
+    if (body.size() - off < sizeof(hdr)) {
+      why = "truncated record header";
+      return false;
+    }
+    memcpy(&hdr, body.data() + off, sizeof(hdr));
+    if (hdr.magic != Archive::kMagic) {
+      why = "bad record magic";
+      return false;
+    }
+    std::size_t bytes = sizeof(hdr) +
+        sizeof(float) * hdr.channels * hdr.numSamples;
+    if (body.size() - off < bytes) {
+      why = "truncated record";
+      return false;
+    }
+    id = hdr.id;
+    off += bytes;
+    count++;
+  }
+  return count > 0;
+}
+
+// Inflate a `Content-Encoding: gzip` body
+static bool gunzip(const std::string& in, std::string& out)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    return false;
+  zs.next_in = (Bytef *)in.data();
+  zs.avail_in = in.size();
+  char buf[64 * 1024];
+  int ret;
+  do {
+    zs.next_out = (Bytef *)buf;
+    zs.avail_out = sizeof(buf);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END)
+      break;
+    out.append(buf, sizeof(buf) - zs.avail_out);
+  } while (ret != Z_STREAM_END);
+  inflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+struct Faults {
+  double latencyMs = 0;
+  double jitterMs = 0;
+  double errorRate = 0;
+  double resetRate = 0;
+  double slowReadBps = 0;
+};
+
+struct Counters {
+  uint64_t requests = 0;
+  uint64_t streamChunks = 0;
+  uint64_t streamGaps = 0; // chunks skipped by a seq jump
+  uint64_t streamDups = 0;
+  uint64_t accepted = 0;
+  uint64_t rejected = 0;
+  uint64_t injectedErrors = 0;
+  uint64_t injectedResets = 0;
+  uint64_t windows = 0;
+  uint64_t gps = 0;
+  uint64_t bytes = 0;
+};
+
+struct Server;
+
+struct Conn {
+  Server *server;
+  uint64_t id;
+  int fd;
+  void *watch;
+  std::string in;
+  std::string out;
+  std::size_t headerLen = 0;
+  std::size_t bodyLen = 0;
+  bool keepAlive = true;
+  bool chunked = false;     // Transfer-Encoding: chunked
+  std::size_t decoded = 0;  // bytes of `in` decoded into `body`
+  std::size_t chunkLeft = 0;
+  bool chunkEnd = false;    // terminating chunk seen
+  std::string body;         // decoded chunked body not consumed yet
+  bool busy = false;   // waiting for a delayed response
+  bool paused = false; // read budget exhausted
+  long budget = 0;
+  std::string method, path, query, contentType, contentEncoding;
+};
+
+// Per (user_id, session) stream position
+struct StreamState {
+  uint64_t nextSeq = 0;
+};
+
+struct Server {
+  EpollLoop loop;
+  int listenFd = -1;
+  Faults faults;
+  Counters total, lastTick;
+  std::set<Conn *> conns;
+  uint64_t nextConnId = 0;
+  std::mt19937 rng{42};
+  FILE *log = nullptr;
+  std::chrono::steady_clock::time_point started;
+  bool quiet = false;
+  std::map<std::pair<int, uint64_t>, StreamState> streams;
+  std::vector<uint64_t> latencyMs = std::vector<uint64_t>(10001);
+
+  double uniform()
+  {
+    return std::uniform_real_distribution<double>(0, 1)(rng);
+  }
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+  stopRequested = 1;
+}
+
+static uint64_t nowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void closeConn(Conn *c, bool reset = false)
+{
+  if (reset) {
+    struct linger lg = {1, 0};
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  }
+  c->server->loop.unwatchFd(c->watch);
+  close(c->fd);
+  c->server->conns.erase(c);
+  delete c;
+}
+
+static void updateWatch(Conn *c)
+{
+  int events = 0;
+  if (!c->busy && !c->paused)
+    events |= Loop::READ;
+  if (!c->out.empty())
+    events |= Loop::WRITE;
+  c->server->loop.modifyFd(c->watch, events);
+}
+
+static void queueResponse(Conn *c, int status, const std::string& body)
+{
+  const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request" :
+                       status == 404 ? "Not Found" : "Service Unavailable";
+  char head[256];
+  snprintf(head, sizeof(head),
+           "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+           "Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+           status, reason, body.size(), c->keepAlive ? "keep-alive" : "close");
+  c->out += head;
+  c->out += body;
+}
+
+struct Delayed {
+  Server *server;
+  uint64_t connId;
+  int status;
+  std::string body;
+};
+
+static bool delayedCb(void *data)
+{
+  Delayed *d = (Delayed *)data;
+  // The connection may have gone away while we were waiting
+  for (Conn *c : d->server->conns) {
+    if (c->id == d->connId) {
+      c->busy = false;
+      queueResponse(c, d->status, d->body);
+      updateWatch(c);
+      break;
+    }
+  }
+  delete d;
+  return false;
+}
+
+// Stream latency at quantile `q`, in ms (the last bin holds 10 s and up)
+static double latencyQuantile(Server *s, double q)
+{
+  uint64_t n = 0;
+  for (uint64_t count : s->latencyMs)
+    n += count;
+  if (!n)
+    return 0;
+  uint64_t rank = (uint64_t)(q * (n - 1)), seen = 0;
+  for (std::size_t ms = 0; ms < s->latencyMs.size(); ms++) {
+    seen += s->latencyMs[ms];
+    if (seen > rank)
+      return ms;
+  }
+  return s->latencyMs.size() - 1;
+}
+
+static std::string statsJson(Server *s)
+{
+  double up = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            s->started).count();
+  char buf[1024];
+  snprintf(buf, sizeof(buf),
+           "{\"uptime\":%.3f,\"requests\":%llu,\"accepted\":%llu,"
+           "\"rejected\":%llu,\"injected_errors\":%llu,\"injected_resets\":%llu,"
+           "\"windows\":%llu,\"gps\":%llu,\"bytes\":%llu,"
+           "\"stream_chunks\":%llu,\"stream_gaps\":%llu,\"stream_dups\":%llu,"
+           "\"stream_p50_ms\":%.0f,\"stream_p99_ms\":%.0f,"
+           "\"stream_max_ms\":%.0f}",
+           up, (unsigned long long)s->total.requests,
+           (unsigned long long)s->total.accepted,
+           (unsigned long long)s->total.rejected,
+           (unsigned long long)s->total.injectedErrors,
+           (unsigned long long)s->total.injectedResets,
+           (unsigned long long)s->total.windows,
+           (unsigned long long)s->total.gps,
+           (unsigned long long)s->total.bytes,
+           (unsigned long long)s->total.streamChunks,
+           (unsigned long long)s->total.streamGaps,
+           (unsigned long long)s->total.streamDups,
+           latencyQuantile(s, 0.5), latencyQuantile(s, 0.99),
+           latencyQuantile(s, 1));
+  return buf;
+}
+
+// Value of `key` in a query string "a=1&b=2"
+static std::string queryParam(const std::string& query, const char *key)
+{
+  std::string k = std::string(key) + "=";
+  std::size_t pos = 0;
+  while (pos < query.size()) {
+    std::size_t end = query.find('&', pos);
+    if (end == std::string::npos)
+      end = query.size();
+    if (query.compare(pos, k.size(), k) == 0)
+      return query.substr(pos + k.size(), end - pos - k.size());
+    pos = end + 1;
+  }
+  return "";
+}
+
+static StreamState& streamOf(Conn *c, int& userId)
+{
+  userId = atoi(queryParam(c->query, "user_id").c_str());
+  uint64_t session = strtoull(queryParam(c->query, "session").c_str(),
+                              nullptr, 10);
+  return c->server->streams[std::make_pair(userId, session)];
+}
+
+//
+// Handle the complete lines of a stream body received so far. Returns
+// false if the connection was closed.
+//
+static bool handleStreamLines(Conn *c)
+{
+  Server *s = c->server;
+  int userId;
+  StreamState& st = streamOf(c, userId);
+  std::size_t start = 0, nl;
+  while ((nl = c->body.find('\n', start)) != std::string::npos) {
+    std::string line = c->body.substr(start, nl - start);
+    start = nl + 1;
+    uint64_t receivedUs = nowUs();
+
+    if (s->uniform() < s->faults.resetRate) {
+      s->total.injectedResets++;
+      closeConn(c, true);
+      return false;
+    }
+    Json j;
+    int status = 200;
+    long long seq = -1;
+    if (!JsonParser(line).parse(j) || !isNumber(j.get("seq")) ||
+        !isNumber(j.get("t0_us"))) {
+      status = 400;
+      s->total.rejected++;
+      if (!s->quiet)
+        fprintf(stderr, "rejected stream line: %s\n", line.c_str());
+    } else {
+      seq = (long long)j.get("seq")->number;
+      if ((uint64_t)seq < st.nextSeq) {
+        s->total.streamDups++;
+      } else {
+        s->total.streamGaps += seq - st.nextSeq;
+        st.nextSeq = seq + 1;
+        s->total.streamChunks++;
+        s->total.bytes += line.size() + 1;
+        double t0 = j.get("t0_us")->number;
+        double ms = receivedUs > t0 ? (receivedUs - t0) / 1000 : 0;
+        s->latencyMs[std::min<std::size_t>((std::size_t)ms,
+                                           s->latencyMs.size() - 1)]++;
+      }
+    }
+    if (s->log) {
+      fprintf(s->log, "%llu,%s,%zu,%d,%d,%lld\n",
+              (unsigned long long)receivedUs, c->path.c_str(),
+              line.size() + 1, status, userId, seq);
+    }
+  }
+  c->body.erase(0, start);
+  return true;
+}
+
+static void applyControl(Server *s, const Json& j)
+{
+  if (isNumber(j.get("latency_ms"))) s->faults.latencyMs = j.get("latency_ms")->number;
+  if (isNumber(j.get("jitter_ms"))) s->faults.jitterMs = j.get("jitter_ms")->number;
+  if (isNumber(j.get("error_rate"))) s->faults.errorRate = j.get("error_rate")->number;
+  if (isNumber(j.get("reset_rate"))) s->faults.resetRate = j.get("reset_rate")->number;
+  if (isNumber(j.get("slow_read_bps"))) s->faults.slowReadBps = j.get("slow_read_bps")->number;
+}
+
+//
+// Handle one complete request. Returns false if the connection was closed.
+//
+static bool handleRequest(Conn *c, std::string body)
+{
+  Server *s = c->server;
+  uint64_t receivedUs = nowUs();
+
+  s->total.requests++;
+  std::size_t wireBytes = body.size();
+  int status = 200;
+  std::string reply = "{\"ok\":true}";
+  std::string why;
+  int userId = -1, id = -1;
+  bool upload = c->method == "POST" &&
+                (c->path == "/data/" || c->path == "/data" ||
+                 c->path == "/data/gps");
+
+  if (c->method == "GET" && c->path == "/stats") {
+    reply = statsJson(s);
+  } else if (c->method == "GET" && c->path == "/stream/resume") {
+    reply = "{\"next_seq\":" + std::to_string(streamOf(c, userId).nextSeq) +
+            "}";
+  } else if (c->method == "POST" && c->path == "/stream") {
+    // Lines were handled as they came in (see `processInput`)
+    reply = "{\"ok\":true,\"next_seq\":" +
+            std::to_string(streamOf(c, userId).nextSeq) + "}";
+  } else if (c->method == "POST" && c->path == "/control") {
+    Json j;
+    if (JsonParser(body).parse(j)) {
+      applyControl(s, j);
+    } else {
+      status = 400;
+    }
+  } else if (upload) {
+    if (s->uniform() < s->faults.resetRate) {
+      s->total.injectedResets++;
+      closeConn(c, true);
+      return false;
+    }
+    if (c->contentEncoding == "gzip") {
+      std::string plain;
+      if (gunzip(body, plain)) {
+        body.swap(plain);
+      } else {
+        status = 400;
+        why = "bad gzip body";
+      }
+    } else if (!c->contentEncoding.empty() &&
+               c->contentEncoding != "identity") {
+      status = 400;
+      why = "unsupported encoding " + c->contentEncoding;
+    }
+    if (status != 200) {
+      // undecodable body, rejected below
+    } else if (s->uniform() < s->faults.errorRate) {
+      s->total.injectedErrors++;
+      status = 503;
+      reply = "{\"ok\":false,\"error\":\"injected\"}";
+    } else if (c->path == "/data/gps") {
+      Json j;
+      if (!JsonParser(body).parse(j) || !validGps(j, why, userId)) {
+        status = 400;
+      } else {
+        s->total.gps++;
+      }
+    } else if (c->contentType.find("octet-stream") != std::string::npos) {
+      std::size_t n;
+      if (!validRecords(body, why, n, id))
+        status = 400;
+      else
+        s->total.windows += n;
+    } else {
+      Json j;
+      if (!JsonParser(body).parse(j)) {
+        status = 400;
+        why = "malformed JSON";
+      } else if (j.type == Json::ARRAY) {
+        for (const Json& w : j.items) {
+          if (!validWindow(w, why, userId, id)) {
+            status = 400;
+            break;
+          }
+        }
+        if (status == 200)
+          s->total.windows += j.items.size();
+      } else if (!validWindow(j, why, userId, id)) {
+        status = 400;
+      } else {
+        s->total.windows++;
+      }
+    }
+    if (status == 200) {
+      s->total.accepted++;
+      s->total.bytes += wireBytes;
+    } else if (status == 400) {
+      s->total.rejected++;
+      reply = "{\"ok\":false,\"error\":\"" + why + "\"}";
+      if (!s->quiet)
+        fprintf(stderr, "rejected %s: %s\n", c->path.c_str(), why.c_str());
+    }
+    if (s->log) {
+      fprintf(s->log, "%llu,%s,%zu,%d,%d,%d\n",
+              (unsigned long long)receivedUs, c->path.c_str(), wireBytes,
+              status, userId, id);
+    }
+  } else {
+    status = 404;
+    reply = "{\"ok\":false}";
+  }
+
+  double delayMs = s->faults.latencyMs;
+  if (s->faults.jitterMs > 0)
+    delayMs += s->faults.jitterMs * (2 * s->uniform() - 1);
+  if (upload && delayMs > 0) {
+    c->busy = true;
+    s->loop.addTimer(delayMs / 1000.0, delayedCb,
+                     new Delayed{s, c->id, status, reply});
+  } else {
+    queueResponse(c, status, reply);
+  }
+  return true;
+}
+
+//
+// Move what has arrived of a chunked body from `c->in` to `c->body`.
+// Returns false (and closes the connection) on a malformed body.
+//
+static bool decodeChunks(Conn *c)
+{
+  while (!c->chunkEnd) {
+    if (c->chunkLeft > 0) {
+      std::size_t n = std::min(c->chunkLeft, c->in.size() - c->decoded);
+      if (!n)
+        return true;
+      c->body.append(c->in, c->decoded, n);
+      c->decoded += n;
+      c->chunkLeft -= n;
+      continue;
+    }
+    // "\r\n" closing the previous chunk (if any), then "<hex size>\r\n"
+    std::size_t at = c->decoded;
+    if (c->in.compare(at, 2, "\r\n") == 0 && at > c->headerLen)
+      at += 2;
+    else if (at > c->headerLen && c->in.size() - at < 2)
+      return true;
+    std::size_t eol = c->in.find("\r\n", at);
+    if (eol == std::string::npos)
+      return true;
+    char *end;
+    unsigned long size = strtoul(c->in.c_str() + at, &end, 16);
+    if (end == c->in.c_str() + at) {
+      closeConn(c);
+      return false;
+    }
+    if (size == 0) {
+      // Last chunk; no trailers expected
+      if (c->in.size() < eol + 4)
+        return true;
+      c->decoded = eol + 4;
+      c->chunkEnd = true;
+      break;
+    }
+    c->decoded = eol + 2;
+    c->chunkLeft = size;
+  }
+  return true;
+}
+
+// Parse as many complete requests out of `c->in` as possible
+static bool processInput(Conn *c)
+{
+  while (!c->busy) {
+    if (!c->headerLen) {
+      std::size_t end = c->in.find("\r\n\r\n");
+      if (end == std::string::npos)
+        return true;
+      c->headerLen = end + 4;
+      std::string head = c->in.substr(0, end);
+
+      std::size_t sp1 = head.find(' ');
+      std::size_t sp2 = head.find(' ', sp1 + 1);
+      c->method = head.substr(0, sp1);
+      c->path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+      std::size_t q = c->path.find('?');
+      c->query = q == std::string::npos ? "" : c->path.substr(q + 1);
+      if (q != std::string::npos)
+        c->path.erase(q);
+      c->bodyLen = 0;
+      c->keepAlive = true;
+      c->chunked = false;
+      c->chunkEnd = false;
+      c->chunkLeft = 0;
+      c->body.clear();
+      c->contentType.clear();
+      c->contentEncoding.clear();
+
+      std::size_t pos = head.find("\r\n");
+      while (pos != std::string::npos) {
+        std::size_t next = head.find("\r\n", pos + 2);
+        std::string line = head.substr(pos + 2, next == std::string::npos ?
+                                       std::string::npos : next - pos - 2);
+        std::size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+          std::string key = line.substr(0, colon);
+          for (auto& ch : key)
+            ch = tolower(ch);
+          std::string val = line.substr(colon + 1);
+          val.erase(0, val.find_first_not_of(' '));
+          if (key == "content-length")
+            c->bodyLen = strtoul(val.c_str(), nullptr, 10);
+          else if (key == "connection" && (val == "close" || val == "Close"))
+            c->keepAlive = false;
+          else if (key == "content-type")
+            c->contentType = val;
+          else if (key == "content-encoding")
+            c->contentEncoding = val;
+          else if (key == "transfer-encoding" && val == "chunked")
+            c->chunked = true;
+        }
+        pos = next;
+      }
+      c->decoded = c->headerLen;
+    }
+
+    if (c->chunked) {
+      if (!decodeChunks(c))
+        return false;
+      if (c->method == "POST" && c->path == "/stream" &&
+          !handleStreamLines(c))
+        return false;
+      if (!c->chunkEnd)
+        return true;
+      c->in.erase(0, c->decoded);
+      c->headerLen = 0;
+      std::string body;
+      body.swap(c->body);
+      if (!handleRequest(c, body))
+        return false;
+      continue;
+    }
+
+    if (c->in.size() < c->headerLen + c->bodyLen)
+      return true;
+    std::string body = c->in.substr(c->headerLen, c->bodyLen);
+    c->in.erase(0, c->headerLen + c->bodyLen);
+    c->headerLen = c->bodyLen = 0;
+    if (!handleRequest(c, body))
+      return false;
+  }
+  return true;
+}
+
+static void connCb(void *data, int fd, int events)
+{
+  Conn *c = (Conn *)data;
+  Server *s = c->server;
+
+  if (events & Loop::READ) {
+    char buf[64 * 1024];
+    std::size_t want = sizeof(buf);
+    if (s->faults.slowReadBps > 0) {
+      if (c->budget <= 0) {
+        c->paused = true;
+        updateWatch(c);
+        return;
+      }
+      want = std::min<std::size_t>(want, c->budget);
+    }
+    ssize_t n = read(fd, buf, want);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      closeConn(c);
+      return;
+    }
+    if (n > 0) {
+      c->budget -= n;
+      c->in.append(buf, n);
+      if (!processInput(c))
+        return;
+    }
+  }
+
+  if (!c->out.empty()) {
+    ssize_t n = write(fd, c->out.data(), c->out.size());
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      closeConn(c);
+      return;
+    }
+    if (n > 0)
+      c->out.erase(0, n);
+    if (c->out.empty() && !c->keepAlive && !c->busy) {
+      closeConn(c);
+      return;
+    }
+  }
+  updateWatch(c);
+}
+
+static void acceptCb(void *data, int fd, int)
+{
+  Server *s = (Server *)data;
+  while (true) {
+    int cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0)
+      return;
+    int one = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Conn *c = new Conn();
+    c->server = s;
+    c->id = s->nextConnId++;
+    c->fd = cfd;
+    c->budget = (long)(s->faults.slowReadBps / 10);
+    c->watch = s->loop.watchFd(cfd, Loop::READ, connCb, c);
+    s->conns.insert(c);
+  }
+}
+
+// Every 100 ms: refill read budgets, resume paused connections
+static bool budgetCb(void *data)
+{
+  Server *s = (Server *)data;
+  long refill = (long)(s->faults.slowReadBps / 10);
+  for (Conn *c : s->conns) {
+    c->budget = refill;
+    if (c->paused) {
+      c->paused = false;
+      updateWatch(c);
+    }
+  }
+  return true;
+}
+
+// Every second: throughput line, shutdown on SIGINT/SIGTERM
+static bool reportCb(void *data)
+{
+  Server *s = (Server *)data;
+  if (!s->quiet) {
+    Counters d = s->total;
+    fprintf(stderr, "%6llu req/s %6llu windows/s %8.3f MB/s  (%llu conns)\n",
+            (unsigned long long)(d.requests - s->lastTick.requests),
+            (unsigned long long)(d.windows - s->lastTick.windows),
+            (d.bytes - s->lastTick.bytes) / 1e6,
+            (unsigned long long)s->conns.size());
+    s->lastTick = d;
+  }
+  if (s->log)
+    fflush(s->log);
+  return true;
+}
+
+static bool stopCb(void *data)
+{
+  Server *s = (Server *)data;
+  if (stopRequested)
+    s->loop.quit();
+  return !stopRequested;
+}
+
+int main(int argc, char *argv[])
+{
+  Server server;
+  int port = 8080;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--quiet") {
+      server.quiet = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "missing value for %s\n", arg.c_str());
+      return 1;
+    }
+    const char *val = argv[++i];
+    if (arg == "--port") port = atoi(val);
+    else if (arg == "--log") server.log = fopen(val, "w");
+    else if (arg == "--latency-ms") server.faults.latencyMs = atof(val);
+    else if (arg == "--jitter-ms") server.faults.jitterMs = atof(val);
+    else if (arg == "--error-rate") server.faults.errorRate = atof(val);
+    else if (arg == "--reset-rate") server.faults.resetRate = atof(val);
+    else if (arg == "--slow-read-bps") server.faults.slowReadBps = atof(val);
+    else {
+      fprintf(stderr,
+              "usage: %s [--port N] [--log FILE] [--quiet] [--latency-ms MS]\n"
+              "          [--jitter-ms MS] [--error-rate F] [--reset-rate F]\n"
+              "          [--slow-read-bps B]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  server.listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(server.listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(server.listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(server.listenFd, 1024) < 0) {
+    perror("bind/listen");
+    return 1;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  server.started = std::chrono::steady_clock::now();
+  server.loop.watchFd(server.listenFd, Loop::READ, acceptCb, &server);
+  server.loop.addTimer(0.1, budgetCb, &server);
+  server.loop.addTimer(1.0, reportCb, &server);
+  server.loop.addTimer(0.1, stopCb, &server);
+  fprintf(stderr, "listening on 127.0.0.1:%d\n", port);
+  server.loop.run();
+
+  fprintf(stderr, "%s\n", statsJson(&server).c_str());
+  while (!server.conns.empty())
+    closeConn(*server.conns.begin());
+  close(server.listenFd);
+  if (server.log)
+    fclose(server.log);
+  return 0;
+}
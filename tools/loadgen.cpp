@@ -0,0 +1,350 @@
+//
+// Fleet load generator: simulates many watches uploading windows to an
+// ingest server, using the app's own `Measure` and `HttpEngine`.
+//
+// Every simulated device has its own user id and, once per period,
+// produces one accelerometer and one gyroscope window (synthetic
+// motion, or the window rows of a CSV trace in the `Archive::exportCsv`
+// layout, e.g. a RECORD_CSV recording). Devices are spread over
+// generator threads; each thread keeps its devices in a min-heap of due
+// times. Requests go through a single `HttpEngine` on an `EpollLoop`.
+//
+//   g++ -std=c++17 -O2 -pthread -I tools/shim -I src tools/loadgen.cpp -lcurl -o loadgen
+//   ./loadgen --devices 2000 --period 60 --duration 120
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "sensors.h"
+#include "data.h"
+#include "loop.h"
+#include "http.h"
+
+#define DURATION 60 // seconds
+
+// Same sensor set as the app
+using SimSensors = SensorList<Accelerometer, Gyroscope>;
+static const std::size_t NUM_SENSORS = SimSensors::size;
+
+struct Options {
+  std::string url = "localhost:8080/data/";
+  int devices = 100;
+  int threads = 4;
+  int firstUserId = 1000;
+  double period = DURATION; // s between windows of one device
+  double jitter = 0.1;      // +- fraction of `period`
+  double duration = 60;     // s
+  int batch = 1;            // windows per POST
+  unsigned inFlight = 64;
+  std::string trace;
+};
+
+// One recorded window: `samples[c]` holds stored-rate values of channel c
+struct TraceWindow {
+  std::vector<std::vector<float>> samples;
+};
+
+// Recorded windows, by sensor index
+typedef std::vector<TraceWindow> Trace[NUM_SENSORS];
+
+struct Stats {
+  std::vector<double> latencies; // loop thread only
+  uint64_t failed = 0;
+  uint64_t bytes = 0;
+  uint64_t windows = 0;
+};
+
+static bool loadTrace(const std::string& path, Trace& trace)
+{
+  std::size_t channels[NUM_SENSORS];
+  forEachSensor<SimSensors>([&channels](auto i) {
+    channels[i] = SensorAt<decltype(i)::value, SimSensors>::channels;
+  });
+
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::vector<float> values;
+    std::istringstream iss(line);
+    std::string cell;
+    while (std::getline(iss, cell, ','))
+      values.push_back(strtof(cell.c_str(), nullptr));
+    if (values.size() < 5 || values[3] != MEASURE_WINDOW)
+      continue;
+    std::size_t type = (std::size_t)values[2];
+    if (type >= NUM_SENSORS)
+      continue;
+    TraceWindow w;
+    std::size_t n = (values.size() - 4) / channels[type];
+    w.samples.resize(channels[type]);
+    for (std::size_t c = 0; c < channels[type]; c++) {
+      w.samples[c].assign(values.begin() + 4 + c * n,
+                          values.begin() + 4 + (c + 1) * n);
+    }
+    trace[type].push_back(std::move(w));
+  }
+  for (auto& windows : trace) {
+    if (windows.empty())
+      return false;
+  }
+  return true;
+}
+
+//
+// Fill a window the same way `sensorCb` does: one `tick` per device
+// sampling period.
+//
+template <typename M>
+static void fillSynthetic(M& m, std::mt19937& rng, double phase)
+{
+  std::normal_distribution<float> noise(0.f, 0.05f);
+  const int ratio = M::_samplingPeriod / M::_deviceSamplingPeriod;
+  const std::size_t ticks = DURATION * 1000 / M::_samplingPeriod * ratio;
+  float v[M::C];
+  for (std::size_t t = 0; t < ticks && !m._done; t++) {
+    double s = phase + t * M::_deviceSamplingPeriod / 1000.0;
+    for (std::size_t c = 0; c < M::C; c++) {
+      double wave = c % 2 ? cos(2 * M_PI * 1.8 * s) : sin(2 * M_PI * 1.8 * s);
+      v[c] = (float)(0.3 * wave) + noise(rng);
+    }
+    if (m._type == 0)
+      v[M::C - 1] += 9.81f; // gravity on the accelerometer's z axis
+    m.tick(v);
+  }
+}
+
+template <typename M>
+static void fillTrace(M& m, const TraceWindow& w)
+{
+  const int ratio = M::_samplingPeriod / M::_deviceSamplingPeriod;
+  float v[M::C];
+  for (std::size_t j = 0; j < w.samples[0].size() && !m._done; j++) {
+    for (std::size_t c = 0; c < M::C; c++)
+      v[c] = w.samples[c][j];
+    for (int r = 0; r < ratio; r++)
+      m.tick(v);
+  }
+}
+
+struct Device {
+  int userId;
+  int nextId;
+  std::size_t traceIdx[NUM_SENSORS];
+  std::vector<std::string> pending; // formatted windows not yet sent
+};
+
+static void generatorJob(const Options& opt, int first, int count,
+                         const Trace& trace, bool replay,
+                         HttpEngine& http, Stats& stats,
+                         std::atomic<uint64_t>& generated)
+{
+  typedef std::chrono::steady_clock Clock;
+  typedef std::pair<Clock::time_point, int> Due;
+
+  std::mt19937 rng(first);
+  std::uniform_real_distribution<double> unit(-1, 1);
+  auto jittered = [&]() {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opt.period * (1 + opt.jitter * unit(rng))));
+  };
+
+  std::vector<Device> devices(count);
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(opt.duration));
+  for (int i = 0; i < count; i++) {
+    devices[i].userId = opt.firstUserId + first + i;
+    devices[i].nextId = 0;
+    for (std::size_t s = 0; s < NUM_SENSORS; s++)
+      devices[i].traceIdx[s] = replay ? (first + i) % trace[s].size() : 0;
+    // Spread the first uploads over one period
+    auto offset = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opt.period * (unit(rng) + 1) / 2));
+    due.push(Due(start + offset, i));
+  }
+
+  while (!due.empty()) {
+    Due next = due.top();
+    due.pop();
+    if (next.first >= end)
+      break;
+    std::this_thread::sleep_until(next.first);
+
+    Device& d = devices[next.second];
+    unsigned long long timestamp = (unsigned long long)time(nullptr);
+    forEachSensor<SimSensors>([&](auto i) {
+      using S = SensorAt<decltype(i)::value, SimSensors>;
+      auto m = std::make_unique<Measure<S, DURATION>>(d.nextId, i, 0,
+                                                      timestamp, d.userId);
+      if (!replay) {
+        fillSynthetic(*m, rng, next.second * 0.37);
+      } else {
+        fillTrace(*m, trace[i][d.traceIdx[i]]);
+        d.traceIdx[i] = (d.traceIdx[i] + 1) % trace[i].size();
+      }
+      d.pending.push_back(m->formatJson());
+      generated++;
+    });
+    d.nextId++;
+
+    while ((int)d.pending.size() >= opt.batch) {
+      HttpRequest req;
+      req.url = opt.url;
+      std::size_t n = opt.batch;
+      if (n == 1) {
+        req.body = std::move(d.pending.front());
+      } else {
+        req.body = "[";
+        for (std::size_t i = 0; i < n; i++) {
+          if (i)
+            req.body += ",";
+          req.body += d.pending[i];
+        }
+        req.body += "]";
+      }
+      d.pending.erase(d.pending.begin(), d.pending.begin() + n);
+      req.done = [&stats, n](const HttpRequest& req, const HttpResult& res) {
+        if (res.ok()) {
+          stats.latencies.push_back(res.seconds);
+          stats.bytes += req.body.size();
+          stats.windows += n;
+        } else {
+          stats.failed++;
+        }
+      };
+      http.post(std::move(req));
+    }
+
+    due.push(Due(next.first + jittered(), next.second));
+  }
+}
+
+struct Shutdown {
+  EpollLoop *loop;
+  HttpEngine *http;
+  std::atomic<bool> generatorsDone;
+};
+
+static bool shutdownCb(void *data)
+{
+  Shutdown *s = (Shutdown *)data;
+  if (s->generatorsDone && s->http->busy() == 0) {
+    s->loop->quit();
+    return false;
+  }
+  return true;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  std::size_t idx = (std::size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [--url URL] [--devices N] [--threads N] [--user-id N]\n"
+          "          [--period S] [--jitter F] [--duration S] [--batch N]\n"
+          "          [--inflight N] [--trace FILE.csv]\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (!strcmp(arg, "--url")) opt.url = val;
+    else if (!strcmp(arg, "--devices")) opt.devices = atoi(val);
+    else if (!strcmp(arg, "--threads")) opt.threads = atoi(val);
+    else if (!strcmp(arg, "--user-id")) opt.firstUserId = atoi(val);
+    else if (!strcmp(arg, "--period")) opt.period = atof(val);
+    else if (!strcmp(arg, "--jitter")) opt.jitter = atof(val);
+    else if (!strcmp(arg, "--duration")) opt.duration = atof(val);
+    else if (!strcmp(arg, "--batch")) opt.batch = std::max(1, atoi(val));
+    else if (!strcmp(arg, "--inflight")) opt.inFlight = atoi(val);
+    else if (!strcmp(arg, "--trace")) opt.trace = val;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+  }
+
+  Trace trace;
+  bool replay = !opt.trace.empty();
+  if (replay) {
+    if (!loadTrace(opt.trace, trace)) {
+      fprintf(stderr, "%s lacks windows for some sensors\n", opt.trace.c_str());
+      return 1;
+    }
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  Stats stats;
+  std::atomic<uint64_t> generated(0);
+  {
+    EpollLoop loop;
+    HttpEngine http(loop, opt.inFlight);
+    Shutdown shutdown{&loop, &http, {false}};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> generators;
+    int threads = std::max(1, std::min(opt.threads, opt.devices));
+    for (int t = 0; t < threads; t++) {
+      int first = opt.devices * t / threads;
+      int count = opt.devices * (t + 1) / threads - first;
+      generators.emplace_back(generatorJob, std::cref(opt), first, count,
+                              std::cref(trace), replay, std::ref(http),
+                              std::ref(stats), std::ref(generated));
+    }
+    std::thread joiner([&]() {
+      for (auto& g : generators)
+        g.join();
+      shutdown.generatorsDone = true;
+    });
+
+    loop.addTimer(0.1, shutdownCb, &shutdown);
+    loop.run();
+    joiner.join();
+
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    std::vector<double>& lat = stats.latencies;
+    std::sort(lat.begin(), lat.end());
+
+    printf("devices %d, period %.1f s, batch %d, %.1f s\n", opt.devices,
+           opt.period, opt.batch, secs);
+    printf("windows   generated %llu, delivered %llu, failed requests %llu, retries %llu\n",
+           (unsigned long long)generated.load(),
+           (unsigned long long)stats.windows,
+           (unsigned long long)stats.failed,
+           (unsigned long long)http.metrics.retried);
+    printf("throughput %.1f req/s, %.1f windows/s, %.2f MB/s\n",
+           lat.size() / secs, stats.windows / secs, stats.bytes / secs / 1e6);
+    printf("latency   p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+           percentile(lat, 0.50) * 1e3, percentile(lat, 0.90) * 1e3,
+           percentile(lat, 0.99) * 1e3, lat.empty() ? 0 : lat.back() * 1e3);
+  }
+  curl_global_cleanup();
+  return 0;
+}
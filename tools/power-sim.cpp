@@ -0,0 +1,170 @@
+//
+// Power profile estimator: what a day of measuring costs under each
+// profile of `power.h`, and which profile `PowerGovernor` picks as the
+// battery drains and charges.
+//
+// For every profile it counts CPU wakeups (sensor events when the CPU is
+// not held awake, upload bursts, GPS fixes) and the bytes put on the
+// radio per day. Bytes are measured on real windows at the profile's
+// rates, serialized and compressed as the upload pipeline does (full
+// windows, or summaries with `--capture`). Event segments are left out:
+// they depend on what the wearer does, not on the profile.
+//
+//   g++ -std=c++17 -O2 -pthread -I tools/shim -I src tools/power-sim.cpp -lz -o power-sim
+//   ./power-sim --capture
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <memory>
+
+#include "sensors.h"
+#include "data.h"
+#include "pipeline.h"
+#include "power.h"
+
+#define DURATION 60 // seconds
+
+// Same sensor set as the app
+using SimSensors = SensorList<Accelerometer, Gyroscope>;
+
+template <typename S>
+using SimMeasure = Measure<S, DURATION>;
+
+static const double DAY = 24 * 60 * 60; // s
+
+struct Options {
+  bool capture = false; // upload summaries instead of windows
+  int gpsBytes = 96;    // body of one location upload
+};
+
+struct DayCost {
+  double sensorEvents = 0;
+  double sensorWakeups = 0;
+  double uploadBursts = 0;
+  double requests = 0;
+  double gpsFixes = 0;
+  double rawBytes = 0;
+  double wireBytes = 0;
+};
+
+// One full window of sensor `S` at profile `p`, with synthetic motion
+template <typename S>
+static std::unique_ptr<SimMeasure<S>> makeWindow(const PowerProfile& p)
+{
+  std::unique_ptr<SimMeasure<S>> m(
+      new SimMeasure<S>(0, 0, 0, 1500000000ULL, 0,
+                        S::devicePeriod * p.deviceScale,
+                        S::storedPeriod * p.storedScale));
+  float v[S::channels];
+  for (int t = 0; !m->_done; t++) {
+    for (std::size_t c = 0; c < S::channels; c++)
+      v[c] = std::sin(0.05f * t + c) + 0.01f * (float)(rand() % 100);
+    m->tick(v);
+  }
+  return m;
+}
+
+static DayCost estimate(const PowerProfile& p, const Options& opt)
+{
+  DayCost cost;
+  forEachSensor<SimSensors>([&](auto i) {
+    using S = SensorAt<decltype(i)::value, SimSensors>;
+    double events = DAY * 1000 / (S::devicePeriod * p.deviceScale);
+    cost.sensorEvents += events;
+    if (!p.cpuLock)
+      cost.sensorWakeups += events;
+
+    auto m = makeWindow<S>(p);
+    Payload payload;
+    payload.body = opt.capture ? m->formatSummaryJson() : m->formatJson();
+    gzipPayload(payload);
+    double windows = DAY / DURATION;
+    cost.requests += windows;
+    cost.rawBytes += windows * payload.rawBytes;
+    cost.wireBytes += windows * payload.body.size();
+  });
+
+  // Without a cadence every window is its own burst
+  cost.uploadBursts = p.uploadPeriod > 0 ? DAY / p.uploadPeriod
+                                         : cost.requests;
+  if (p.gpsPeriod > 0) {
+    cost.gpsFixes = DAY / p.gpsPeriod;
+    cost.uploadBursts += cost.gpsFixes;
+    cost.requests += cost.gpsFixes;
+    cost.rawBytes += cost.gpsFixes * opt.gpsBytes;
+    cost.wireBytes += cost.gpsFixes * opt.gpsBytes;
+  }
+  return cost;
+}
+
+static void printProfiles(const Options& opt)
+{
+  printf("%-9s %7s %12s %12s %9s %9s %8s %10s %10s\n", "profile", "cpuLock",
+         "events/d", "wakeups/d", "bursts/d", "reqs/d", "gps/d", "raw MB/d",
+         "wire MB/d");
+  for (int i = 0; i < NUM_PROFILES; i++) {
+    const PowerProfile& p = powerProfiles[i];
+    DayCost c = estimate(p, opt);
+    printf("%-9s %7s %12.0f %12.0f %9.0f %9.0f %8.0f %10.2f %10.2f\n",
+           p.name, p.cpuLock ? "yes" : "no", c.sensorEvents,
+           c.sensorWakeups + c.uploadBursts, c.uploadBursts, c.requests,
+           c.gpsFixes, c.rawBytes / 1e6, c.wireBytes / 1e6);
+  }
+}
+
+// Discharge from 100 % to 0 %, with a platform low-battery event at
+// `lowAt`, then charge back up; print every profile change
+static void printSweep(int lowAt)
+{
+  PowerGovernor gov;
+  int profile = gov.update(100, false);
+  printf("\nbattery sweep (low-battery event at %d%%)\n", lowAt);
+  printf("  %4d%% %-8s -> %s\n", 100, "", powerProfiles[profile].name);
+
+  auto step = [&](int percent, bool charging, const char *what) {
+    int next = gov.update(percent, charging);
+    if (percent == lowAt && !charging)
+      next = gov.lowBattery();
+    if (next != profile) {
+      printf("  %4d%% %-8s -> %s\n", percent, what, powerProfiles[next].name);
+      profile = next;
+    }
+  };
+  for (int percent = 99; percent >= 0; percent--)
+    step(percent, false, "drain");
+  step(0, true, "plug in");
+  step(30, false, "unplug");
+  for (int percent = 30; percent <= 100; percent++)
+    step(percent, false, "recover");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [--capture] [--gps-bytes N] [--low-at PERCENT]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  int lowAt = 15;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--capture"))
+      opt.capture = true;
+    else if (!strcmp(argv[i], "--gps-bytes") && i + 1 < argc)
+      opt.gpsBytes = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--low-at") && i + 1 < argc)
+      lowAt = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+
+  printf("uploads: %s\n\n", opt.capture ? "summaries" : "windows");
+  printProfiles(opt);
+  printSweep(lowAt);
+  return 0;
+}
@@ -0,0 +1,90 @@
+//
+// Contention benchmark for `Queue` (src/queue.h).
+//
+// N producers enqueue small items across the priority classes while M
+// consumers take them either one at a time (`dequeue`) or in batches
+// (`dequeue_batch`). Every run ends with `drainDone`, so the consumed
+// count must equal the produced count.
+//
+//   g++ -std=c++14 -O2 -pthread -I src tools/queue-bench.cpp -o queue-bench
+//   ./queue-bench [producers] [consumers] [items per producer] [batch]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "queue.h"
+
+struct Item {
+  int producer;
+  int seq;
+};
+
+typedef Queue<Item, 3> BenchQueue;
+
+static double run(int producers, int consumers, int items, std::size_t batch)
+{
+  BenchQueue queue;
+  std::atomic<long> consumed(0);
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&queue, &consumed, batch]() {
+      if (batch <= 1) {
+        while (auto item = queue.dequeue())
+          consumed++;
+        return;
+      }
+      std::vector<std::unique_ptr<Item>> out;
+      while (queue.dequeue_batch(out, batch, std::chrono::milliseconds(10))) {
+        consumed += out.size();
+        out.clear();
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int p = 0; p < producers; p++) {
+    writers.emplace_back([&queue, p, items]() {
+      for (int i = 0; i < items; i++)
+        queue.enqueue(std::unique_ptr<Item>(new Item{p, i}), i % 3);
+    });
+  }
+  for (auto& t : writers)
+    t.join();
+
+  queue.drainDone();
+  for (auto& t : threads)
+    t.join();
+
+  double secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  long expected = (long)producers * items;
+  if (consumed != expected) {
+    fprintf(stderr, "lost items: consumed %ld of %ld\n", consumed.load(),
+            expected);
+    exit(1);
+  }
+  return expected / secs;
+}
+
+int main(int argc, char *argv[])
+{
+  int producers = argc > 1 ? atoi(argv[1]) : 4;
+  int consumers = argc > 2 ? atoi(argv[2]) : 4;
+  int items = argc > 3 ? atoi(argv[3]) : 200000;
+  std::size_t batch = argc > 4 ? atoi(argv[4]) : 64;
+
+  printf("%d producers, %d consumers, %d items each\n", producers, consumers,
+         items);
+  printf("  dequeue           %12.0f items/s\n",
+         run(producers, consumers, items, 1));
+  printf("  dequeue_batch(%zu) %12.0f items/s\n", batch,
+         run(producers, consumers, items, batch));
+  return 0;
+}
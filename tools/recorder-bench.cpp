@@ -0,0 +1,167 @@
+//
+// Recorder throughput benchmark: how much faster than the live data rate
+// `Recorder` (recorder.h) can write windows to disk, compared with the
+// straightforward `Measure::format` + `std::ofstream` approach.
+//
+// Full accelerometer and gyroscope windows with synthetic motion are
+// pushed as fast as possible; the live rate is one window per sensor per
+// `DURATION` seconds.
+//
+//   g++ -std=c++17 -O2 -pthread -I tools/shim -I src tools/recorder-bench.cpp -o recorder-bench
+//   ./recorder-bench --windows 20000 --dir /tmp
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <fstream>
+
+#include "sensors.h"
+#include "data.h"
+#include "recorder.h"
+
+#define DURATION 60 // seconds
+
+// Same sensor set as the app
+using SimSensors = SensorList<Accelerometer, Gyroscope>;
+static const std::size_t NUM_SENSORS = SimSensors::size;
+
+template <typename S>
+using SimMeasure = Measure<S, DURATION>;
+
+struct Options {
+  int windows = 10000;
+  std::string dir = "/tmp";
+  std::size_t rotateBytes = 64 * 1024 * 1024;
+  bool baseline = true;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// One full window per sensor, reused for every record
+static std::vector<std::unique_ptr<MeasureBase>> makeWindows()
+{
+  std::vector<std::unique_ptr<MeasureBase>> windows;
+  forEachSensor<SimSensors>([&](auto i) {
+    using S = SensorAt<decltype(i)::value, SimSensors>;
+    std::unique_ptr<SimMeasure<S>> m(
+        new SimMeasure<S>(0, i, 0, 1500000000ULL));
+    float v[S::channels];
+    for (int t = 0; !m->_done; t++) {
+      for (std::size_t c = 0; c < S::channels; c++)
+        v[c] = 9.81f * std::sin(0.013f * t + c) + 0.001f * (rand() % 1000);
+      m->tick(v);
+    }
+    windows.push_back(std::move(m));
+  });
+  return windows;
+}
+
+static void report(const char *name, int n, double s, uint64_t bytes)
+{
+  double live = (double)NUM_SENSORS / DURATION; // windows/s
+  printf("%-16s %8d windows %7.3f s %9.0f win/s %8.1f MB/s %10.0fx live\n",
+         name, n, s, n / s, bytes / s / 1e6, n / s / live);
+}
+
+static void removeFiles(const std::string& path)
+{
+  unlink(path.c_str());
+  for (int n = 1; unlink((path + "." + std::to_string(n)).c_str()) == 0; n++)
+    ;
+}
+
+static void benchRecorder(const Options& opt,
+                          std::vector<std::unique_ptr<MeasureBase>>& windows,
+                          RecordFormat format)
+{
+  std::string path = opt.dir + "/recorder-bench." +
+                     (format == RECORD_CSV ? "csv" : "bin");
+  removeFiles(path);
+
+  Recorder recorder;
+  RecorderOptions ro;
+  ro.format = format;
+  ro.rotateBytes = opt.rotateBytes;
+  if (!recorder.open(path, ro) || !recorder.start()) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return;
+  }
+
+  Clock::time_point t = Clock::now();
+  for (int i = 0; i < opt.windows; i++) {
+    MeasureBase& m = *windows[i % windows.size()];
+    m._id = i;
+    recorder.record(m);
+  }
+  recorder.stop();
+  recorder.close();
+  std::chrono::duration<double> s = Clock::now() - t;
+
+  report(format == RECORD_CSV ? "recorder csv" : "recorder binary",
+         opt.windows, s.count(), recorder.bytes());
+  printf("%16s %llu files rotated, %llu syncs, %llu blocked records\n", "",
+         (unsigned long long)recorder.files(),
+         (unsigned long long)recorder.syncs(),
+         (unsigned long long)recorder.blocked());
+  removeFiles(path);
+}
+
+// One `format()` string and one flushed line per window
+static void benchBaseline(const Options& opt,
+                          std::vector<std::unique_ptr<MeasureBase>>& windows)
+{
+  std::string path = opt.dir + "/recorder-bench-baseline.csv";
+  std::ofstream ofs(path, std::ios::trunc);
+  uint64_t bytes = 0;
+
+  Clock::time_point t = Clock::now();
+  for (int i = 0; i < opt.windows; i++) {
+    MeasureBase& m = *windows[i % windows.size()];
+    m._id = i;
+    std::string line = m.format();
+    bytes += line.size() + 1;
+    ofs << line << std::endl;
+  }
+  ofs.close();
+  std::chrono::duration<double> s = Clock::now() - t;
+
+  report("format+ofstream", opt.windows, s.count(), bytes);
+  unlink(path.c_str());
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [--windows N] [--dir DIR] [--rotate-mb N] "
+          "[--no-baseline]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--windows") && i + 1 < argc)
+      opt.windows = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--dir") && i + 1 < argc)
+      opt.dir = argv[++i];
+    else if (!strcmp(argv[i], "--rotate-mb") && i + 1 < argc)
+      opt.rotateBytes = (std::size_t)atoi(argv[++i]) * 1024 * 1024;
+    else if (!strcmp(argv[i], "--no-baseline"))
+      opt.baseline = false;
+    else
+      usage(argv[0]);
+  }
+
+  auto windows = makeWindows();
+  benchRecorder(opt, windows, RECORD_CSV);
+  benchRecorder(opt, windows, RECORD_BINARY);
+  if (opt.baseline)
+    benchBaseline(opt, windows);
+  return 0;
+}
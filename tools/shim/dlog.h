@@ -0,0 +1,39 @@
+#ifndef __SHIM_DLOG_H__
+#define __SHIM_DLOG_H__
+
+#include <cstdio>
+#include <cstdarg>
+
+//
+// Host stand-in for Tizen's <dlog.h>: messages at `dlogLevel` or above go
+// to stderr as "<level>/<tag>: <message>".
+//
+typedef enum {
+  DLOG_UNKNOWN = 0,
+  DLOG_DEFAULT,
+  DLOG_VERBOSE,
+  DLOG_DEBUG,
+  DLOG_INFO,
+  DLOG_WARN,
+  DLOG_ERROR,
+  DLOG_FATAL,
+  DLOG_SILENT
+} log_priority;
+
+inline log_priority dlogLevel = DLOG_INFO;
+
+inline int dlog_print(log_priority prio, const char *tag, const char *fmt, ...)
+{
+  static const char levels[] = "??VDIWEFS";
+  if (prio < dlogLevel)
+    return 0;
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%c/%s: ", levels[prio], tag);
+  int n = vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  return n;
+}
+
+#endif /* __SHIM_DLOG_H__ */
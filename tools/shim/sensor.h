@@ -0,0 +1,35 @@
+#ifndef __SHIM_SENSOR_H__
+#define __SHIM_SENSOR_H__
+
+//
+// Host stand-in for Tizen's <sensor.h>: the types sensors.h and the
+// platform interface refer to, with the values of the real header.
+//
+typedef enum {
+  SENSOR_ALL = -1,
+  SENSOR_ACCELEROMETER = 0,
+  SENSOR_GRAVITY,
+  SENSOR_LINEAR_ACCELERATION,
+  SENSOR_MAGNETIC,
+  SENSOR_ROTATION_VECTOR,
+  SENSOR_ORIENTATION,
+  SENSOR_GYROSCOPE,
+  SENSOR_LIGHT,
+  SENSOR_PROXIMITY,
+  SENSOR_PRESSURE,
+  SENSOR_ULTRAVIOLET,
+  SENSOR_TEMPERATURE,
+  SENSOR_HUMIDITY,
+  SENSOR_HRM
+} sensor_type_e;
+
+typedef void *sensor_h;
+
+typedef struct {
+  int accuracy;
+  unsigned long long timestamp;
+  int value_count;
+  float values[16];
+} sensor_event_s;
+
+#endif /* __SHIM_SENSOR_H__ */